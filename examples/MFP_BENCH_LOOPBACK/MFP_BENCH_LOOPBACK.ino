@@ -0,0 +1,204 @@
+// Measures scan(), print() and supported() end to end against the mock
+// device in MockDevice.h, which runs on the same board over loopback.
+// Reports throughput, latency percentiles and heap allocations per call for
+// several image sizes and response chunking patterns, after a few checks of
+// scans against the capability cache. No real MFP needed; Wi-Fi only runs
+// as an access point so the network stack is up.
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_heap_caps.h>
+#include <algorithm>
+#include "ArduinoMFP.h"
+#include "MockDevice.h"
+
+const char* host = "127.0.0.1";
+const int iterations = 10;
+
+const size_t imageSizes[] = {16 * 1024, 64 * 1024, 256 * 1024};
+const size_t chunkSizes[] = {0, 536, 4096};  // 0 = Content-Length
+const size_t printSizes[] = {16 * 1024, 256 * 1024};
+
+ArduinoMFP mfp;
+
+// Live heap blocks, sampled while a call runs
+struct HeapProbe {
+  size_t baseBlocks = 0;
+  size_t peakBlocks = 0;
+  size_t endBlocks = 0;
+
+  static size_t blocks() {
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+    return info.allocated_blocks;
+  }
+  void begin() { baseBlocks = peakBlocks = blocks(); }
+  void sample() { peakBlocks = max(peakBlocks, blocks()); }
+  void end() {
+    endBlocks = blocks();
+    sample();
+  }
+};
+
+HeapProbe* activeProbe = nullptr;
+
+class CountingPrint : public Print {
+public:
+  size_t bytes = 0;
+  size_t write(uint8_t) override { bytes++; return 1; }
+  size_t write(const uint8_t*, size_t len) override {
+    bytes += len;
+    if (activeProbe) activeProbe->sample();
+    return len;
+  }
+};
+
+struct Result {
+  uint32_t us[iterations];
+  size_t bytes = 0;
+  int failures = 0;
+  HeapProbe heap;
+};
+
+uint32_t percentile(const uint32_t* sorted, int n, int p) {
+  int i = (p * n + 99) / 100 - 1;
+  return sorted[constrain(i, 0, n - 1)];
+}
+
+void report(const char* name, Result& r) {
+  std::sort(r.us, r.us + iterations);
+  uint64_t total = 0;
+  for (int i = 0; i < iterations; i++) total += r.us[i];
+  char kbPerSec[12] = "-";
+  if (total && r.bytes) snprintf(kbPerSec, sizeof(kbPerSec), "%.1f", (float)r.bytes / 1024.0f / ((float)total / 1e6f));
+  Serial.printf("%-26s %8s %7.2f %7.2f %7.2f %7.2f %6d %6d %4d\n", name, kbPerSec,
+                percentile(r.us, iterations, 50) / 1000.0f, percentile(r.us, iterations, 90) / 1000.0f,
+                percentile(r.us, iterations, 99) / 1000.0f, r.us[iterations - 1] / 1000.0f,
+                (int)(r.heap.peakBlocks - r.heap.baseBlocks), (int)(r.heap.endBlocks - r.heap.baseBlocks), r.failures);
+}
+
+const char* pattern(size_t chunk) {
+  static char text[16];
+  if (chunk) snprintf(text, sizeof(text), "chunk %u", (unsigned)chunk);
+  else strcpy(text, "length");
+  return text;
+}
+
+// Timed runs first, then one more run with heap sampling (heap walks are slow)
+template <typename Call>
+void measure(const char* name, Call call) {
+  Result r;
+  call(r);  // warm-up: connection pool, buffer pool
+  r.bytes = 0;
+  r.failures = 0;
+  for (int i = 0; i < iterations; i++) {
+    unsigned long t = micros();
+    call(r);
+    r.us[i] = micros() - t;
+  }
+  size_t bytes = r.bytes;
+  int failures = r.failures;
+  activeProbe = &r.heap;
+  r.heap.begin();
+  call(r);
+  r.heap.end();
+  activeProbe = nullptr;
+  r.bytes = bytes;
+  r.failures = failures;
+  report(name, r);
+}
+
+void benchScan() {
+  for (size_t size : imageSizes) {
+    for (size_t chunk : chunkSizes) {
+      mockConfig.imageSize = size;
+      mockConfig.chunkSize = chunk;
+      char name[40];
+      snprintf(name, sizeof(name), "scan %3uK %s", (unsigned)(size / 1024), pattern(chunk));
+      measure(name, [](Result& r) {
+        CountingPrint out;
+        if (!mfp.scan(300, 300, "Platen", host, mockWsdPort, "jfif", out)) r.failures++;
+        r.bytes += out.bytes;
+      });
+    }
+  }
+}
+
+void benchPrint() {
+  for (size_t size : printSizes) {
+    char name[40];
+    snprintf(name, sizeof(name), "print %3uK stream", (unsigned)(size / 1024));
+    measure(name, [size](Result& r) {
+      size_t sent = 0;
+      bool ok = mfp.print(host, mockRawPort, [&sent, size](uint8_t* buffer, size_t len) {
+        size_t n = min(len, size - sent);
+        memset(buffer, 'x', n);
+        sent += n;
+        if (activeProbe) activeProbe->sample();
+        return n;
+      });
+      if (!ok) r.failures++;
+      r.bytes += sent;
+    });
+  }
+}
+
+void benchSupported() {
+  for (size_t chunk : chunkSizes) {
+    mockConfig.chunkSize = chunk;
+    char name[40];
+    snprintf(name, sizeof(name), "supported %s", pattern(chunk));
+    measure(name, [](Result& r) {
+      MFPDeviceInfo info;
+      if (!mfp.supported(host, mockWsdPort, info)) r.failures++;
+    });
+  }
+}
+
+// The mock reports jfif and png: MIME types of those pass the local check, others do not
+void checkFormats() {
+  MFPCapabilities caps;
+  bool cached = mfp.getCapabilities(host, mockWsdPort, caps);
+  CountingPrint out;
+  bool mime = mfp.scan(300, 300, "Platen", host, mockWsdPort, "image/jpeg", out);
+  bool wsd = mfp.scan(300, 300, "Platen", host, mockWsdPort, "jfif", out);
+  bool rejected = !mfp.scan(300, 300, "Platen", host, mockWsdPort, "image/tiff", out);
+  Serial.printf("capabilities cached: %s\n", cached ? "ok" : "FAIL");
+  Serial.printf("cached scan image/jpeg: %s\n", mime ? "ok" : "FAIL");
+  Serial.printf("cached scan jfif: %s\n", wsd ? "ok" : "FAIL");
+  Serial.printf("cached scan image/tiff rejected: %s\n", rejected ? "ok" : "FAIL");
+  mfp.getCapabilityCache().invalidate();
+}
+
+// A DHT with three 1-bit codes: the thumbnail stage must refuse it, not overrun its tables
+void checkThumbnail() {
+  static const uint8_t badDht[] = {
+    0xFF, 0xD8, 0xFF, 0xC4, 0x00, 0x16, 0x00,
+    3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 2, 3, 0xFF, 0xD9
+  };
+  MFPJpegThumbnail thumb;
+  thumb.begin();
+  thumb.feed(badDht, sizeof(badDht));
+  thumb.end();
+  Serial.printf("malformed DHT rejected: %s\n", !thumb.ready() ? "ok" : "FAIL");
+}
+
+void setup() {
+  Serial.begin(115200);
+  delay(1000);
+  WiFi.mode(WIFI_AP);
+  WiFi.softAP("mfp-bench");
+  mockBegin();
+
+  checkFormats();
+  checkThumbnail();
+  Serial.printf("%d runs per case; blocks = live heap allocations above baseline (peak, after)\n", iterations);
+  Serial.printf("%-26s %8s %7s %7s %7s %7s %6s %6s %4s\n", "case", "KB/s", "p50 ms", "p90 ms", "p99 ms", "max ms", "peak", "after", "fail");
+  benchScan();
+  benchPrint();
+  benchSupported();
+  mfp.closeConnections();
+}
+
+void loop() {
+}
@@ -0,0 +1,280 @@
+// Minimal WSD scanner/printer that runs on the ESP32 itself, so ArduinoMFP
+// can be measured over the loopback interface without a real device.
+//   port mockWsdPort: GetMetadata, GetScannerElements, CreateScanJob, RetrieveImage
+//   port mockRawPort: raw (port 9100 style) printing, replies "OK" after a form feed
+// Every connection is served by its own task, so pooled keep-alive sockets
+// do not block new ones.
+#pragma once
+#include <Arduino.h>
+#include <WiFi.h>
+
+const uint16_t mockWsdPort = 8080;
+const uint16_t mockRawPort = 9100;
+const char* const mockBoundary = "uuid:5e1c7a2d-mock-boundary";
+
+// Read by the connection tasks; set between benchmark cases
+struct MockConfig {
+  size_t imageSize = 64 * 1024;
+  size_t chunkSize = 0;       // 0 = Content-Length, else chunked with this chunk size
+};
+MockConfig mockConfig;
+volatile uint32_t mockPrinted = 0;  // bytes received by the last raw print job
+
+// Writes a response body either as-is or in HTTP chunks of a fixed size
+class MockBodyWriter : public Print {
+public:
+  MockBodyWriter(WiFiClient& c, uint8_t* buf, size_t chunk) : client(c), buffer(buf), chunkSize(chunk), used(0) {}
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  size_t write(const uint8_t* data, size_t len) override {
+    if (!chunkSize) return client.write(data, len);
+    size_t done = 0;
+    while (done < len) {
+      size_t n = min(len - done, chunkSize - used);
+      memcpy(buffer + used, data + done, n);
+      used += n;
+      done += n;
+      if (used == chunkSize) flushChunk();
+    }
+    return len;
+  }
+  void finish() {
+    if (!chunkSize) return;
+    flushChunk();
+    client.print("0\r\n\r\n");
+  }
+private:
+  WiFiClient& client;
+  uint8_t* buffer;
+  size_t chunkSize;
+  size_t used;
+
+  void flushChunk() {
+    if (!used) return;
+    client.printf("%x\r\n", (unsigned)used);
+    client.write(buffer, used);
+    client.print("\r\n");
+    used = 0;
+  }
+};
+
+// Reads one header line; false on timeout or when the peer closed
+static bool mockReadLine(WiFiClient& c, char* line, size_t size, uint32_t timeoutMs) {
+  size_t n = 0;
+  unsigned long start = millis();
+  while (millis() - start < timeoutMs) {
+    int ch = c.read();
+    if (ch < 0) {
+      if (!c.connected()) return false;
+      delay(1);
+      continue;
+    }
+    if (ch == '\n') {
+      if (n > 0 && line[n - 1] == '\r') n--;
+      line[n] = 0;
+      return true;
+    }
+    if (n < size - 1) line[n++] = (char)ch;
+  }
+  return false;
+}
+
+// Keeps the first size-1 bytes of the body, discards the rest
+static size_t mockReadBody(WiFiClient& c, char* body, size_t size, size_t len) {
+  size_t kept = 0;
+  unsigned long start = millis();
+  while (len > 0 && millis() - start < 3000) {
+    uint8_t tmp[256];
+    int n = c.read(tmp, min(len, sizeof(tmp)));
+    if (n <= 0) {
+      if (!c.connected()) break;
+      delay(1);
+      continue;
+    }
+    size_t keep = min((size_t)n, size - 1 - kept);
+    memcpy(body + kept, tmp, keep);
+    kept += keep;
+    len -= n;
+  }
+  body[kept] = 0;
+  return kept;
+}
+
+static void mockHeaders(WiFiClient& c, const char* contentType, long length, bool chunked) {
+  c.print("HTTP/1.1 200 OK\r\nContent-Type: ");
+  c.print(contentType);
+  if (chunked) c.print("\r\nTransfer-Encoding: chunked");
+  else c.printf("\r\nContent-Length: %ld", length);
+  c.print("\r\nConnection: keep-alive\r\n\r\n");
+}
+
+static void mockSendXml(WiFiClient& c, const char* xml, uint8_t* buffer) {
+  size_t len = strlen(xml);
+  size_t chunk = mockConfig.chunkSize;
+  mockHeaders(c, "application/soap+xml", len, chunk > 0);
+  MockBodyWriter out(c, buffer, chunk);
+  out.write((const uint8_t*)xml, len);
+  out.finish();
+}
+
+static const char mockEnvelopeStart[] =
+  "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+  "<soap:Envelope xmlns:soap=\"http://www.w3.org/2003/05/soap-envelope\" "
+  "xmlns:wsa=\"http://schemas.xmlsoap.org/ws/2004/08/addressing\" "
+  "xmlns:wsdp=\"http://schemas.xmlsoap.org/ws/2006/02/devprof\" "
+  "xmlns:wscn=\"http://schemas.microsoft.com/windows/2006/08/wdp/scan\"><soap:Body>";
+static const char mockEnvelopeEnd[] = "</soap:Body></soap:Envelope>";
+
+static void mockMetadata(WiFiClient& c, char* xml, size_t size, uint8_t* buffer) {
+  snprintf(xml, size,
+    "%s<wsx:Metadata xmlns:wsx=\"http://schemas.xmlsoap.org/ws/2004/09/mex\">"
+    "<wsx:MetadataSection><wsdp:ThisModel><wsdp:ModelName xml:lang=\"en\">Loopback MFP</wsdp:ModelName>"
+    "<wsdp:ModelUrl>http://127.0.0.1</wsdp:ModelUrl></wsdp:ThisModel></wsx:MetadataSection>"
+    "<wsx:MetadataSection><wsdp:Relationship>"
+    "<wsdp:Host><wsa:EndpointReference><wsa:Address>urn:uuid:8c1f5d2e-0b6a-4f3c-9e7d-1a2b3c4d5e6f</wsa:Address></wsa:EndpointReference></wsdp:Host>"
+    "<wsdp:Hosted><wsa:EndpointReference><wsa:Address>http://127.0.0.1:%u/WebServices/PrinterService</wsa:Address></wsa:EndpointReference>"
+    "<wsdp:Types>wprt:PrinterServiceType</wsdp:Types></wsdp:Hosted>"
+    "<wsdp:Hosted><wsa:EndpointReference><wsa:Address>http://127.0.0.1:%u/WebServices/ScannerService</wsa:Address></wsa:EndpointReference>"
+    "<wsdp:Types>wscn:ScannerServiceType</wsdp:Types></wsdp:Hosted>"
+    "</wsdp:Relationship></wsx:MetadataSection></wsx:Metadata>%s",
+    mockEnvelopeStart, mockWsdPort, mockWsdPort, mockEnvelopeEnd);
+  mockSendXml(c, xml, buffer);
+}
+
+static void mockScannerElements(WiFiClient& c, char* xml, size_t size, uint8_t* buffer) {
+  snprintf(xml, size,
+    "%s<wscn:GetScannerElementsResponse><wscn:ScannerElements><wscn:ElementData Name=\"wscn:ScannerConfiguration\" Valid=\"true\">"
+    "<wscn:ScannerConfiguration><wscn:DeviceSettings><wscn:FormatsSupported>"
+    "<wscn:FormatValue>jfif</wscn:FormatValue><wscn:FormatValue>png</wscn:FormatValue></wscn:FormatsSupported></wscn:DeviceSettings>"
+    "<wscn:Platen><wscn:PlatenResolutions><wscn:Widths><wscn:Width>150</wscn:Width><wscn:Width>300</wscn:Width></wscn:Widths>"
+    "<wscn:Heights><wscn:Height>150</wscn:Height><wscn:Height>300</wscn:Height></wscn:Heights></wscn:PlatenResolutions></wscn:Platen>"
+    "</wscn:ScannerConfiguration></wscn:ElementData></wscn:ScannerElements></wscn:GetScannerElementsResponse>%s",
+    mockEnvelopeStart, mockEnvelopeEnd);
+  mockSendXml(c, xml, buffer);
+}
+
+static void mockCreateScanJob(WiFiClient& c, char* xml, size_t size, uint8_t* buffer) {
+  static uint32_t jobId = 0;
+  jobId++;
+  snprintf(xml, size,
+    "%s<wscn:CreateScanJobResponse><wscn:JobId>%u</wscn:JobId><wscn:JobToken>token-%u</wscn:JobToken></wscn:CreateScanJobResponse>%s",
+    mockEnvelopeStart, (unsigned)jobId, (unsigned)jobId, mockEnvelopeEnd);
+  mockSendXml(c, xml, buffer);
+}
+
+// JPEG markers around a byte pattern; the content is never decoded
+static void mockWriteImage(Print& out, size_t size) {
+  uint8_t block[512];
+  size_t sent = 0;
+  while (sent < size) {
+    size_t n = min(sizeof(block), size - sent);
+    for (size_t i = 0; i < n; i++) block[i] = (uint8_t)((sent + i) * 31 + 7);
+    if (sent == 0 && n >= 2) {
+      block[0] = 0xFF;
+      block[1] = 0xD8;
+    }
+    if (sent + n == size && n >= 2) {
+      block[n - 2] = 0xFF;
+      block[n - 1] = 0xD9;
+    }
+    out.write(block, n);
+    sent += n;
+  }
+}
+
+static void mockRetrieveImage(WiFiClient& c, char* xml, size_t size, uint8_t* buffer) {
+  snprintf(xml, size, "%s<wscn:RetrieveImageResponse/>%s", mockEnvelopeStart, mockEnvelopeEnd);
+  char head[256];
+  int headLen = snprintf(head, sizeof(head),
+    "--%s\r\nContent-Type: application/xop+xml; type=\"application/soap+xml\"\r\n\r\n", mockBoundary);
+  char part[128];
+  int partLen = snprintf(part, sizeof(part), "\r\n--%s\r\nContent-Type: image/jpeg\r\n\r\n", mockBoundary);
+  char tail[96];
+  int tailLen = snprintf(tail, sizeof(tail), "\r\n--%s--\r\n", mockBoundary);
+  size_t imageSize = mockConfig.imageSize;
+  size_t chunk = mockConfig.chunkSize;
+
+  char type[128];
+  snprintf(type, sizeof(type), "multipart/related; boundary=\"%s\"; type=\"application/xop+xml\"", mockBoundary);
+  mockHeaders(c, type, headLen + strlen(xml) + partLen + imageSize + tailLen, chunk > 0);
+  MockBodyWriter out(c, buffer, chunk);
+  out.write((const uint8_t*)head, headLen);
+  out.write((const uint8_t*)xml, strlen(xml));
+  out.write((const uint8_t*)part, partLen);
+  mockWriteImage(out, imageSize);
+  out.write((const uint8_t*)tail, tailLen);
+  out.finish();
+}
+
+static void mockWsdTask(void* arg) {
+  WiFiClient* client = (WiFiClient*)arg;
+  char line[160];
+  char body[2048];   // requests are kept for matching, responses are built here too
+  uint8_t chunkBuffer[4096];
+
+  // Keep-alive: serve requests until the library closes the pooled socket
+  while (mockReadLine(*client, line, sizeof(line), 30000)) {
+    bool device = strstr(line, "/WebServices/Device") != nullptr;
+    size_t contentLength = 0;
+    while (mockReadLine(*client, line, sizeof(line), 3000) && line[0]) {
+      if (strncasecmp(line, "Content-Length:", 15) == 0) contentLength = atol(line + 15);
+    }
+    mockReadBody(*client, body, sizeof(body), contentLength);
+
+    if (device) mockMetadata(*client, body, sizeof(body), chunkBuffer);
+    else if (strstr(body, "GetScannerElements")) mockScannerElements(*client, body, sizeof(body), chunkBuffer);
+    else if (strstr(body, "CreateScanJob")) mockCreateScanJob(*client, body, sizeof(body), chunkBuffer);
+    else if (strstr(body, "RetrieveImage")) mockRetrieveImage(*client, body, sizeof(body), chunkBuffer);
+    else client->print("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+  }
+  client->stop();
+  delete client;
+  vTaskDelete(nullptr);
+}
+
+static void mockRawTask(void* arg) {
+  WiFiClient* client = (WiFiClient*)arg;
+  uint8_t buffer[1460];
+  uint32_t received = 0;
+  uint8_t last = 0;
+  unsigned long lastData = millis();
+  // A stream print ends when the library closes the socket, a text print with a form feed
+  while (millis() - lastData < 3000) {
+    int n = client->read(buffer, sizeof(buffer));
+    if (n > 0) {
+      received += n;
+      last = buffer[n - 1];
+      lastData = millis();
+      if (last == '\f') break;
+    } else if (!client->connected()) {
+      break;
+    } else {
+      delay(1);
+    }
+  }
+  mockPrinted = received;
+  if (last == '\f') client->print("OK");
+  client->stop();
+  delete client;
+  vTaskDelete(nullptr);
+}
+
+static void mockServerTask(void* arg) {
+  static WiFiServer wsd(mockWsdPort);
+  static WiFiServer raw(mockRawPort);
+  wsd.begin();
+  raw.begin();
+  wsd.setNoDelay(true);
+  for (;;) {
+    WiFiClient c = wsd.available();
+    if (c) xTaskCreate(mockWsdTask, "mock-wsd", 12288, new WiFiClient(c), 2, nullptr);
+    WiFiClient p = raw.available();
+    if (p) xTaskCreate(mockRawTask, "mock-raw", 6144, new WiFiClient(p), 2, nullptr);
+    delay(1);
+  }
+}
+
+// Starts the servers on the other core
+inline void mockBegin() {
+  xTaskCreatePinnedToCore(mockServerTask, "mock-server", 4096, nullptr, 2, nullptr, 0);
+  delay(100);
+}
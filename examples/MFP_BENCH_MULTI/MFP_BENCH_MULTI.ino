@@ -0,0 +1,100 @@
+// Aggregate scan throughput against 1, 2 and 4 mock devices (MockDevices.h,
+// on the same board over loopback). Each case runs the same jobs twice: one
+// after another on a single instance with blocking scan(), then all submitted
+// to an MFPScheduler, which keeps one job per device running and polls them
+// from both cores. Every image waits for the mock's scan time first, as on a
+// real scanner, so most of the gain comes from overlapping that wait.
+#include <Arduino.h>
+#include <WiFi.h>
+#include "ArduinoMFP.h"
+#include "MFPScheduler.h"
+#include "MockDevices.h"
+
+const char* host = "127.0.0.1";
+const int deviceCounts[] = {1, 2, 4};
+const int jobsPerDevice = 4;
+
+MFPBufferPool sharedPool;  // declared first so it outlives the instances using it
+ArduinoMFP mfp;
+MFPScheduler scheduler;
+
+// Updated from both worker tasks
+size_t received = 0;
+int failures = 0;
+
+bool countBytes(const uint8_t*, size_t len) {
+  __atomic_add_fetch(&received, len, __ATOMIC_RELAXED);
+  return true;
+}
+
+void report(const char* mode, int devices, uint32_t ms) {
+  int jobs = devices * jobsPerDevice;
+  Serial.printf("%-10s %7d %5d %8u %9.1f %7.2f %4d\n", mode, devices, jobs, (unsigned)ms,
+                (float)received / 1024.0f / (ms / 1000.0f), jobs / (ms / 1000.0f), failures);
+}
+
+void runSequential(int devices) {
+  for (int j = 0; j < jobsPerDevice; j++) {
+    for (int d = 0; d < devices; d++) {
+      if (!mfp.scan(300, 300, "Platen", host, mockFirstPort + d, "jfif", countBytes)) failures++;
+    }
+  }
+}
+
+void runScheduled(int devices) {
+  for (int j = 0; j < jobsPerDevice; j++) {
+    for (int d = 0; d < devices; d++) {
+      uint16_t port = mockFirstPort + d;
+      char device[24];
+      snprintf(device, sizeof(device), "%s:%u", host, port);
+      bool queued = scheduler.submit(device, [port](ArduinoMFP& m) {
+        return m.beginScan(300, 300, "Platen", host, port, "jfif", countBytes);
+      }, [](ArduinoMFP&, MFPJobState state) {
+        if (state != MFP_JOB_DONE) __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+      });
+      if (!queued) failures++;
+    }
+  }
+  scheduler.waitIdle();
+}
+
+template <typename Run>
+void measure(const char* mode, int devices, Run run) {
+  received = 0;
+  failures = 0;
+  unsigned long t = millis();
+  run(devices);
+  report(mode, devices, millis() - t);
+}
+
+void setup() {
+  Serial.begin(115200);
+  delay(1000);
+  WiFi.mode(WIFI_AP);
+  WiFi.softAP("mfp-bench");
+  mockBegin();
+
+  mfp.setBufferPool(&sharedPool);
+  for (int i = 0; i < MFP_SCHEDULER_SLOTS; i++) scheduler.instance(i).setBufferPool(&sharedPool);
+  if (!scheduler.begin()) {
+    Serial.println("Scheduler did not start");
+    return;
+  }
+
+  // Warm-up: pooled connections and buffers for every device and instance
+  runSequential(mockMaxDevices);
+  runScheduled(mockMaxDevices);
+
+  Serial.printf("%u KB images, %u ms scan time per image, %d jobs per device\n",
+                (unsigned)(mockConfig.imageSize / 1024), (unsigned)mockConfig.scanDelayMs, jobsPerDevice);
+  Serial.printf("%-10s %7s %5s %8s %9s %7s %4s\n", "mode", "devices", "jobs", "ms", "KB/s", "jobs/s", "fail");
+  for (int devices : deviceCounts) {
+    measure("sequential", devices, runSequential);
+    measure("scheduler", devices, runScheduled);
+  }
+  scheduler.end();
+  mfp.closeConnections();
+}
+
+void loop() {
+}
@@ -0,0 +1,169 @@
+// Several minimal WSD scanners on the ESP32 itself, one per port from
+// mockFirstPort, so jobs for different devices can be measured over loopback.
+// Only CreateScanJob and RetrieveImage are served; every image waits
+// mockConfig.scanDelayMs first, like a scanner moving its head, so the
+// benchmark shows how much device time concurrent jobs can overlap.
+// Every connection is served by its own task.
+#pragma once
+#include <Arduino.h>
+#include <WiFi.h>
+
+const uint16_t mockFirstPort = 8080;
+const int mockMaxDevices = 4;
+const char* const mockBoundary = "uuid:5e1c7a2d-mock-boundary";
+
+// Read by the connection tasks; set between benchmark cases
+struct MockConfig {
+  size_t imageSize = 64 * 1024;
+  uint32_t scanDelayMs = 150;
+};
+MockConfig mockConfig;
+
+// Reads one header line; false on timeout or when the peer closed
+static bool mockReadLine(WiFiClient& c, char* line, size_t size, uint32_t timeoutMs) {
+  size_t n = 0;
+  unsigned long start = millis();
+  while (millis() - start < timeoutMs) {
+    int ch = c.read();
+    if (ch < 0) {
+      if (!c.connected()) return false;
+      delay(1);
+      continue;
+    }
+    if (ch == '\n') {
+      if (n > 0 && line[n - 1] == '\r') n--;
+      line[n] = 0;
+      return true;
+    }
+    if (n < size - 1) line[n++] = (char)ch;
+  }
+  return false;
+}
+
+// Keeps the first size-1 bytes of the body, discards the rest
+static size_t mockReadBody(WiFiClient& c, char* body, size_t size, size_t len) {
+  size_t kept = 0;
+  unsigned long start = millis();
+  while (len > 0 && millis() - start < 3000) {
+    uint8_t tmp[256];
+    int n = c.read(tmp, min(len, sizeof(tmp)));
+    if (n <= 0) {
+      if (!c.connected()) break;
+      delay(1);
+      continue;
+    }
+    size_t keep = min((size_t)n, size - 1 - kept);
+    memcpy(body + kept, tmp, keep);
+    kept += keep;
+    len -= n;
+  }
+  body[kept] = 0;
+  return kept;
+}
+
+static void mockHeaders(WiFiClient& c, const char* contentType, size_t length) {
+  c.print("HTTP/1.1 200 OK\r\nContent-Type: ");
+  c.print(contentType);
+  c.printf("\r\nContent-Length: %u\r\nConnection: keep-alive\r\n\r\n", (unsigned)length);
+}
+
+static const char mockEnvelopeStart[] =
+  "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+  "<soap:Envelope xmlns:soap=\"http://www.w3.org/2003/05/soap-envelope\" "
+  "xmlns:wscn=\"http://schemas.microsoft.com/windows/2006/08/wdp/scan\"><soap:Body>";
+static const char mockEnvelopeEnd[] = "</soap:Body></soap:Envelope>";
+
+static void mockCreateScanJob(WiFiClient& c, char* xml, size_t size) {
+  static uint32_t jobId = 0;
+  uint32_t id = __atomic_add_fetch(&jobId, 1, __ATOMIC_RELAXED);
+  snprintf(xml, size,
+    "%s<wscn:CreateScanJobResponse><wscn:JobId>%u</wscn:JobId><wscn:JobToken>token-%u</wscn:JobToken></wscn:CreateScanJobResponse>%s",
+    mockEnvelopeStart, (unsigned)id, (unsigned)id, mockEnvelopeEnd);
+  mockHeaders(c, "application/soap+xml", strlen(xml));
+  c.print(xml);
+}
+
+// JPEG markers around a byte pattern; the content is never decoded
+static void mockWriteImage(WiFiClient& c, size_t size) {
+  uint8_t block[1024];
+  size_t sent = 0;
+  while (sent < size) {
+    size_t n = min(sizeof(block), size - sent);
+    for (size_t i = 0; i < n; i++) block[i] = (uint8_t)((sent + i) * 31 + 7);
+    if (sent == 0 && n >= 2) {
+      block[0] = 0xFF;
+      block[1] = 0xD8;
+    }
+    if (sent + n == size && n >= 2) {
+      block[n - 2] = 0xFF;
+      block[n - 1] = 0xD9;
+    }
+    c.write(block, n);
+    sent += n;
+  }
+}
+
+static void mockRetrieveImage(WiFiClient& c, char* xml, size_t size) {
+  delay(mockConfig.scanDelayMs);
+  snprintf(xml, size, "%s<wscn:RetrieveImageResponse/>%s", mockEnvelopeStart, mockEnvelopeEnd);
+  char head[128];
+  int headLen = snprintf(head, sizeof(head),
+    "--%s\r\nContent-Type: application/xop+xml; type=\"application/soap+xml\"\r\n\r\n", mockBoundary);
+  char part[96];
+  int partLen = snprintf(part, sizeof(part), "\r\n--%s\r\nContent-Type: image/jpeg\r\n\r\n", mockBoundary);
+  char tail[64];
+  int tailLen = snprintf(tail, sizeof(tail), "\r\n--%s--\r\n", mockBoundary);
+  size_t imageSize = mockConfig.imageSize;
+
+  char type[128];
+  snprintf(type, sizeof(type), "multipart/related; boundary=\"%s\"; type=\"application/xop+xml\"", mockBoundary);
+  mockHeaders(c, type, headLen + strlen(xml) + partLen + imageSize + tailLen);
+  c.write((const uint8_t*)head, headLen);
+  c.print(xml);
+  c.write((const uint8_t*)part, partLen);
+  mockWriteImage(c, imageSize);
+  c.write((const uint8_t*)tail, tailLen);
+}
+
+static void mockWsdTask(void* arg) {
+  WiFiClient* client = (WiFiClient*)arg;
+  char line[160];
+  char body[1024];   // requests are kept for matching, responses are built here too
+
+  // Keep-alive: serve requests until the library closes the pooled socket
+  while (mockReadLine(*client, line, sizeof(line), 30000)) {
+    size_t contentLength = 0;
+    while (mockReadLine(*client, line, sizeof(line), 3000) && line[0]) {
+      if (strncasecmp(line, "Content-Length:", 15) == 0) contentLength = atol(line + 15);
+    }
+    mockReadBody(*client, body, sizeof(body), contentLength);
+
+    if (strstr(body, "CreateScanJob")) mockCreateScanJob(*client, body, sizeof(body));
+    else if (strstr(body, "RetrieveImage")) mockRetrieveImage(*client, body, sizeof(body));
+    else client->print("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+  }
+  client->stop();
+  delete client;
+  vTaskDelete(nullptr);
+}
+
+static void mockServerTask(void* arg) {
+  static WiFiServer* servers[mockMaxDevices];
+  for (int i = 0; i < mockMaxDevices; i++) {
+    servers[i] = new WiFiServer(mockFirstPort + i);
+    servers[i]->begin();
+    servers[i]->setNoDelay(true);
+  }
+  for (;;) {
+    for (int i = 0; i < mockMaxDevices; i++) {
+      WiFiClient c = servers[i]->available();
+      if (c) xTaskCreate(mockWsdTask, "mock-wsd", 8192, new WiFiClient(c), 2, nullptr);
+    }
+    delay(1);
+  }
+}
+
+inline void mockBegin() {
+  xTaskCreate(mockServerTask, "mock-server", 4096, nullptr, 2, nullptr);
+  delay(100);
+}
@@ -0,0 +1,120 @@
+// Compares the old byte-at-a-time boundary loop with MFPMultipartParser.
+// Runs entirely from RAM (no Wi-Fi needed), so it works on the board or in any
+// host build that provides the Arduino core API.
+#include <Arduino.h>
+#include "ArduinoMFP.h"
+
+const char* boundary = "uuid:0ae1d2b9-5c6a-4d1e-9a4f-6b7d3c2e1f00";
+const size_t imageLen = 64 * 1024;
+const int rounds = 4;
+
+uint8_t* body = nullptr;
+size_t bodyLen = 0;
+
+// Serves a RAM buffer through the Stream interface, like WiFiClient would
+class MemoryStream : public Stream {
+public:
+  MemoryStream(const uint8_t* d, size_t n) : data(d), len(n), pos(0) {}
+  int available() override { return len - pos; }
+  int read() override { return pos < len ? data[pos++] : -1; }
+  int peek() override { return pos < len ? data[pos] : -1; }
+  int read(uint8_t* buf, size_t n) {
+    if (n > len - pos) n = len - pos;
+    memcpy(buf, data + pos, n);
+    pos += n;
+    return n;
+  }
+  size_t write(uint8_t) override { return 0; }
+  bool connected() { return pos < len; }
+private:
+  const uint8_t* data;
+  size_t len;
+  size_t pos;
+};
+
+void buildBody() {
+  String head = String("--") + boundary + "\r\nContent-Type: application/xop+xml\r\n\r\n<soap:Envelope/>\r\n--" +
+                boundary + "\r\nContent-Type: image/jpeg\r\n\r\n";
+  String tail = String("\r\n--") + boundary + "--\r\n";
+  bodyLen = head.length() + imageLen + tail.length();
+  body = new uint8_t[bodyLen];
+  memcpy(body, head.c_str(), head.length());
+  for (size_t i = 0; i < imageLen; i++) body[head.length() + i] = (uint8_t)random(0, 256);
+  memcpy(body + head.length() + imageLen, tail.c_str(), tail.length());
+}
+
+// The loop retrieveImage used before: one String per byte plus a memmove
+size_t legacyLoop(MemoryStream& client) {
+  String boundaryStart = String("--") + boundary;
+  String boundaryEnd = boundaryStart + "--";
+  bool foundImagePart = false;
+  while (client.connected()) {
+    String line = client.readStringUntil('\n');
+    line.trim();
+    if (line.startsWith("Content-Type: image/jpeg")) foundImagePart = true;
+    else if (foundImagePart && line == "") break;
+  }
+
+  const int bLen = boundaryStart.length();
+  char* buf = new char[bLen + 4];
+  int bufIdx = 0;
+  size_t total = 0;
+  while (client.connected() || client.available()) {
+    char c = client.read();
+    buf[bufIdx++] = c;
+    if (bufIdx == bLen) {
+      buf[bufIdx] = 0;
+      String bufStr = String(buf).substring(0, bufIdx);
+      if (bufStr == boundaryStart || bufStr == boundaryEnd) break;
+      total++;
+      memmove(buf, buf + 1, bufIdx - 1);
+      bufIdx--;
+    }
+  }
+  delete[] buf;
+  return total;
+}
+
+size_t parserLoop(MemoryStream& client) {
+  MFPMultipartParser parser;
+  parser.begin(boundary);
+  uint8_t block[MFP_BLOCK_SIZE];
+  size_t total = 0;
+  ScanSink sink = [&total](const uint8_t*, size_t len) {
+    total += len;
+    return true;
+  };
+  while (!parser.finished() && client.available()) {
+    int n = client.read(block, sizeof(block));
+    if (n <= 0) break;
+    parser.feed(block, n, sink);
+  }
+  return total;
+}
+
+void report(const char* name, size_t bytes, unsigned long us) {
+  float mbps = us ? (float)bytes / us : 0;  // bytes per us == MB/s
+  Serial.printf("%-8s %7u bytes  %8lu us  %7.2f MB/s\n", name, (unsigned)bytes, us, mbps);
+}
+
+void setup() {
+  Serial.begin(115200);
+  delay(1000);
+  buildBody();
+  Serial.printf("Multipart body: %u bytes, image %u bytes\n", (unsigned)bodyLen, (unsigned)imageLen);
+
+  for (int r = 0; r < rounds; r++) {
+    MemoryStream a(body, bodyLen);
+    unsigned long t = micros();
+    size_t n = legacyLoop(a);
+    report("legacy", n, micros() - t);
+
+    MemoryStream b(body, bodyLen);
+    t = micros();
+    n = parserLoop(b);
+    report("parser", n, micros() - t);
+  }
+}
+
+void loop() {
+}
@@ -0,0 +1,122 @@
+// Compares the old String-concatenation SOAP builders with the template
+// renderer: time per request and heap held while a request is built.
+// No Wi-Fi needed; requests are written to a byte-counting Print.
+#include <Arduino.h>
+#include "ArduinoMFP.h"
+
+const int iterations = 200;
+const char* host = "192.168.1.50";
+
+class CountingPrint : public Print {
+public:
+  size_t bytes = 0;
+  size_t write(uint8_t) override { bytes++; return 1; }
+  size_t write(const uint8_t*, size_t len) override { bytes += len; return len; }
+};
+
+// The builder scan() used before, including the wsa:To replace pass and the request copy
+String legacyCreateScanJob(const String& messageID, const String& jobUUID, int height, int width, const String& origin, const String& format) {
+  String soap =
+  "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+  "<soap:Envelope xmlns:soap=\"http://www.w3.org/2003/05/soap-envelope\" "
+                 "xmlns:wsa=\"http://schemas.xmlsoap.org/ws/2004/08/addressing\" "
+                 "xmlns:sca=\"http://schemas.microsoft.com/windows/2006/08/wdp/scan\">"
+  "<soap:Header>"
+    "<wsa:To>http://" + messageID + "/WebServices/ScannerService</wsa:To>"
+    "<wsa:Action>http://schemas.microsoft.com/windows/2006/08/wdp/scan/CreateScanJob</wsa:Action>"
+    "<wsa:MessageID>urn:uuid:" + messageID + "</wsa:MessageID>"
+    "<wsa:ReplyTo><wsa:Address>http://schemas.xmlsoap.org/ws/2004/08/addressing/role/anonymous</wsa:Address></wsa:ReplyTo>"
+    "<wsa:From><wsa:Address>urn:uuid:" + jobUUID + "</wsa:Address></wsa:From>"
+  "</soap:Header>"
+  "<soap:Body>"
+    "<sca:CreateScanJobRequest>"
+      "<sca:ScanTicket>"
+        "<sca:JobDescription>"
+          "<sca:JobName>Scan Job</sca:JobName>"
+          "<sca:JobOriginatingUserName>ESP32</sca:JobOriginatingUserName>"
+        "</sca:JobDescription>"
+        "<sca:DocumentParameters>"
+          "<sca:Format sca:MustHonor=\"true\">" + format + "</sca:Format>"
+          "<sca:InputSource sca:MustHonor=\"true\">" + origin + "</sca:InputSource>"
+          "<sca:MediaSides>"
+            "<sca:MediaFront>"
+              "<sca:ColorProcessing>RGB24</sca:ColorProcessing>"
+              "<sca:Resolution><sca:Width>" + String(width) + "</sca:Width><sca:Height>" + String(height) + "</sca:Height></sca:Resolution>"
+            "</sca:MediaFront>"
+          "</sca:MediaSides>"
+        "</sca:DocumentParameters>"
+      "</sca:ScanTicket>"
+    "</sca:CreateScanJobRequest>"
+  "</soap:Body>"
+  "</soap:Envelope>";
+  soap.replace("http://" + messageID + "/WebServices/ScannerService", "http://" + String(host) + "/WebServices/ScannerService");
+  return soap;
+}
+
+void legacyRound(Print& out, uint32_t& heapHeld) {
+  uint32_t before = ESP.getFreeHeap();
+  String soap = legacyCreateScanJob("0b7c2c8e-3f0e-4a51-9c1d-2a9c7b1e5f10", "5d3e9a71-8c44-4e0b-b2a6-1f7d0c9e3a28", 300, 300, "Platen", "jfif");
+  String request =
+      "POST /WebServices/ScannerService HTTP/1.1\r\n"
+      "Host: " + String(host) + "\r\n"
+      "Content-Type: application/soap+xml\r\n"
+      "Content-Length: " + soap.length() + "\r\n"
+      "Connection: close\r\n\r\n" +
+      soap;
+  uint32_t held = before - ESP.getFreeHeap();
+  if (held > heapHeld) heapHeld = held;
+  out.print(request);
+}
+
+void templateRound(Print& out, uint32_t& heapHeld, uint8_t* block, size_t blockSize) {
+  uint32_t before = ESP.getFreeHeap();
+  MFPSoapSlots slots;
+  slots.set(SOAP_HOST, host);
+  slots.set(SOAP_MESSAGE_ID, "0b7c2c8e-3f0e-4a51-9c1d-2a9c7b1e5f10");
+  slots.set(SOAP_FROM, "5d3e9a71-8c44-4e0b-b2a6-1f7d0c9e3a28");
+  slots.set(SOAP_FORMAT, "jfif");
+  slots.set(SOAP_ORIGIN, "Platen");
+  slots.set(SOAP_WIDTH, 300L);
+  slots.set(SOAP_HEIGHT, 300L);
+
+  MFPBlockWriter writer(out, block, blockSize);
+  writer.print("POST /WebServices/ScannerService HTTP/1.1\r\nHost: ");
+  writer.print(host);
+  writer.print("\r\nContent-Type: application/soap+xml\r\nContent-Length: ");
+  writer.print((unsigned long)MFPCreateScanJobSoap.length(slots));
+  writer.print("\r\nConnection: close\r\n\r\n");
+  MFPCreateScanJobSoap.write(writer, slots);
+  uint32_t held = before - ESP.getFreeHeap();
+  if (held > heapHeld) heapHeld = held;
+  writer.flush();
+}
+
+void setup() {
+  Serial.begin(115200);
+  delay(1000);
+  static uint8_t block[MFP_BLOCK_SIZE];
+
+  CountingPrint legacyOut;
+  uint32_t legacyHeap = 0;
+  uint32_t largestBefore = ESP.getMaxAllocHeap();
+  unsigned long t = micros();
+  for (int i = 0; i < iterations; i++) legacyRound(legacyOut, legacyHeap);
+  unsigned long legacyUs = micros() - t;
+  uint32_t largestAfter = ESP.getMaxAllocHeap();
+
+  CountingPrint templateOut;
+  uint32_t templateHeap = 0;
+  t = micros();
+  for (int i = 0; i < iterations; i++) templateRound(templateOut, templateHeap, block, sizeof(block));
+  unsigned long templateUs = micros() - t;
+
+  Serial.printf("CreateScanJob request, %d iterations\n", iterations);
+  Serial.printf("legacy:   %5u bytes/request  %6.1f us/request  %6u bytes heap held\n",
+                (unsigned)(legacyOut.bytes / iterations), (float)legacyUs / iterations, (unsigned)legacyHeap);
+  Serial.printf("template: %5u bytes/request  %6.1f us/request  %6u bytes heap held\n",
+                (unsigned)(templateOut.bytes / iterations), (float)templateUs / iterations, (unsigned)templateHeap);
+  Serial.printf("largest free block before/after legacy runs: %u / %u\n", (unsigned)largestBefore, (unsigned)largestAfter);
+}
+
+void loop() {
+}
@@ -2,28 +2,238 @@
 #include <FS.h>        // base filesystem support
 #include <SPIFFS.h>    // SPIFFS support
 #include <LittleFS.h>  // LittleFS support (make sure your board supports this)
-#include <ESPmDNS.h>
 
+static fs::FS& fileSystem(int filesystem) {
+    if (filesystem == 0) return SPIFFS;
+    return LittleFS;
+}
+
+static size_t freeSpace(int filesystem) {
+    if (filesystem == 0) return SPIFFS.totalBytes() - SPIFFS.usedBytes();
+    return LittleFS.totalBytes() - LittleFS.usedBytes();
+}
+
+// Splits http://host[:port]/path; false for anything else
+static bool splitUrl(const String& url, String& host, int& port, String& path) {
+    if (!url.startsWith("http://")) return false;
+    int slash = url.indexOf('/', 7);
+    String authority = slash < 0 ? url.substring(7) : url.substring(7, slash);
+    path = slash < 0 ? "/" : url.substring(slash);
+    int colon = authority.lastIndexOf(':');
+    host = colon < 0 ? authority : authority.substring(0, colon);
+    port = colon < 0 ? 80 : authority.substring(colon + 1).toInt();
+    return host.length() > 0 && port > 0;
+}
+
+// Host, port and path of the hosted scanner service, which may differ from the
+// device's; the device itself and the usual path when the address is missing
+static void scannerService(const char* address, const char* url, int port, String& host, int& servicePort, String& path) {
+    if (splitUrl(address, host, servicePort, path)) return;
+    host = url;
+    servicePort = port;
+    path = "/WebServices/ScannerService";
+}
 
-ArduinoMFP::ArduinoMFP() : imageBuffer(nullptr), imageSize(0) {}
+// Seconds in an xs:duration such as PT1H or P1DT30M; 0 for anything else
+static uint32_t parseDuration(const char* text) {
+    if (*text++ != 'P') return 0;
+    uint32_t total = 0;
+    uint32_t value = 0;
+    bool time = false;
+    for (; *text; text++) {
+        char c = *text;
+        if (c >= '0' && c <= '9') {
+            value = value * 10 + (c - '0');
+            continue;
+        }
+        if (c == '.') {
+            // Fractions of a second are dropped
+            while (text[1] >= '0' && text[1] <= '9') text++;
+            continue;
+        }
+        if (c == 'T') time = true;
+        else if (c == 'D' && !time) total += value * 86400;
+        else if (c == 'H' && time) total += value * 3600;
+        else if (c == 'M' && time) total += value * 60;
+        else if (c == 'S' && time) total += value;
+        else return 0;  // years, months or an absolute time
+        value = 0;
+    }
+    return total;
+}
+
+// A printf conversion in the template gets the first number not used yet
+static bool nextPath(fs::FS& fs, const char* pathTemplate, char* path, size_t size) {
+    if (!strchr(pathTemplate, '%')) {
+        strlcpy(path, pathTemplate, size);
+        return true;
+    }
+    for (int i = 1; i < 10000; i++) {
+        snprintf(path, size, pathTemplate, i);
+        if (!fs.exists(path)) return true;
+    }
+    return false;
+}
+
+#if ARDUINOMFP_STATS
+#define MFP_STATS(statement) statement
+#else
+#define MFP_STATS(statement)
+#endif
+
+// The layout sketches are checked against: see MFPLayout
+template <int... Values>
+MFPLayout<Values...> MFPLayout<Values...>::check() {
+    return MFPLayout();
+}
+template struct MFPLayout<MFP_BLOCK_SIZE, MFP_MAX_STAGES, MFP_MAX_DEVICES, MFP_MAX_CACHED_DEVICES, MFP_POOL_SLOTS>;
+
+MFPDiscovery ArduinoMFP::discovery;
+MFPCapabilityCache ArduinoMFP::capabilities;
+
+ArduinoMFP::ArduinoMFP(MFPBuildLayout) : imageBuffer(nullptr), imageSize(0), imageCapacity(0), expectedImageSize(0), maxImageSize(0), pool(&defaultPool),
+                           responseTimeout(5000), connectTimeout(5000), keepAlive(true), scanProtocol(MFP_SCAN_AUTO), answering(nullptr), ippRequestId(0), pollBudget(10), minFreeSpace(65536), stageCount(0) {
+    rngState = (uint64_t)esp_random() << 32 | esp_random();
+    job.step = JOB_IDLE;
+    job.direct = false;
+    job.escl = false;
+    job.ipp = false;
+    job.ippJobId = 0;
+    job.printing = false;
+    job.batch = false;
+    job.pageReady = false;
+    job.failAfterPage = nullptr;
+    job.parserStarted = false;
+    job.stagesStarted = false;
+    job.call.client = nullptr;
+    job.block = nullptr;
+    job.ticketUsed = false;
+    job.timeFirstByte = false;
+    subscription.active = false;
+    subscription.eventPending = false;
+    subscription.receiving = false;
+    int scanIdTag = subscription.xml.watch("ScanAvailableEvent/ScanIdentifier");
+    int identifierTag = subscription.xml.watch("Header/Identifier");
+    subscription.xml.onValue([this, scanIdTag, identifierTag](int id, const char* text, size_t len) {
+        if (id == scanIdTag) strlcpy(subscription.incoming.scanIdentifier, text, sizeof(subscription.incoming.scanIdentifier));
+        else if (id == identifierTag) strlcpy(subscription.deliveredTo, text, sizeof(subscription.deliveredTo));
+    });
+    prepared.armed = false;
+    prepared.ticket = false;
+    preparedStats = MFPPreparedStats{0, 0, 0, 0, 0, 0, 0, 0};
+    batchStats = MFPBatchStats{0, 0, 0, 0};
+    printStats = MFPPrintStats{0, 0, 0};
+    stats = MFPStats();
+    statsOpen = false;
+
+    // The CreateScanJob reply is parsed as it arrives; ids 0 and 1
+    job.xml.watch("CreateScanJobResponse/JobId");
+    job.xml.watch("CreateScanJobResponse/JobToken");
+    // A RetrieveImage fault (e.g. the feeder is empty) goes through the same parser; id 2
+    job.xml.watch("Subcode/Value");
+    job.xml.onValue([this](int id, const char* text, size_t len) {
+        if (id == 0) job.id = text;
+        else if (id == 1) job.token = text;
+        else job.fault = text;
+    });
+
+    job.parser.onImagePart([this](long length) {
+        return imageAnnounced(length);
+    });
+}
+
+// Stages see each block before the sink, so their results are complete with the image
+bool ArduinoMFP::deliver(const uint8_t* data, size_t len) {
+    if (stageCount) {
+        MFP_STATS(uint32_t stageStart = micros());
+        if (!job.stagesStarted) {
+            job.stagesStarted = true;
+            for (int i = 0; i < stageCount; i++) stages[i]->begin();
+        }
+        for (int i = 0; i < stageCount; i++) stages[i]->feed(data, len);
+        MFP_STATS(stats.stageMicros += micros() - stageStart);
+    }
+    return job.sink(data, len);
+}
+
+// Reject oversized images up front when the device announces the size
+bool ArduinoMFP::imageAnnounced(long length) {
+    if (job.timeFirstByte) preparedFirstByte();
+    if (length < 0) return true;
+    if (maxImageSize && (size_t)length > maxImageSize) {
+        Serial.println("Image exceeds maximum size");
+        return false;
+    }
+    if (job.direct && (size_t)length > job.freeSpace) {
+        Serial.println("Not enough free space for the image");
+        return false;
+    }
+    expectedImageSize = length;
+    return true;
+}
 
 ArduinoMFP::~ArduinoMFP() {
+    // The device drops the subscription itself once it expires
+    if (subscription.active) eventServer.end();
+    cancelJob();
     freeImageBuffer();
+    connections.closeAll();
 }
 
 void ArduinoMFP::freeImageBuffer() {
     if (imageBuffer) {
-        delete[] imageBuffer;
+        // Kept by the pool for the next scan
+        pool->release(imageBuffer);
         imageBuffer = nullptr;
-        imageSize = 0;
     }
+    imageSize = 0;
+    imageCapacity = 0;
+}
+
+bool ArduinoMFP::appendImage(const uint8_t* data, size_t len) {
+    const size_t initialCapacity = 4096;
+    size_t needed = imageSize + len;
+    if (needed > imageCapacity) {
+        size_t allocSize;
+        if (expectedImageSize >= needed) {
+            // Part Content-Length known: allocate once
+            allocSize = expectedImageSize;
+        } else {
+            // Otherwise double, so copying stays linear in the image size
+            allocSize = imageCapacity ? imageCapacity * 2 : initialCapacity;
+            while (allocSize < needed) allocSize *= 2;
+        }
+        if (maxImageSize && allocSize > maxImageSize) allocSize = needed > maxImageSize ? needed : maxImageSize;
+        size_t capacity;
+        uint8_t* newBuffer = imageBuffer ? pool->grow(imageBuffer, imageSize, allocSize, capacity)
+                                         : pool->acquire(allocSize, capacity);
+        if (!newBuffer) return false;
+        MFP_STATS(if (imageBuffer) stats.reallocations++);
+        imageBuffer = newBuffer;
+        imageCapacity = capacity;
+        MFP_STATS(statsHeap());
+    }
+    memcpy(imageBuffer + imageSize, data, len);
+    imageSize += len;
+    return true;
 }
 
-String ArduinoMFP::generateUUID() {
+// splitmix64, seeded from the hardware RNG; nothing is shared with other instances or tasks
+uint32_t ArduinoMFP::nextRandom() {
+    uint64_t z = (rngState += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return (uint32_t)((z ^ (z >> 31)) >> 32);
+}
+
+void ArduinoMFP::generateUUID(char* uuid) {
     const char* hexChars = "0123456789abcdef";
-    char uuid[37]; // 36 + null
-    int i = 0;
-    for (; i < 36; i++) {
+    uint32_t bits = 0;
+    for (int i = 0; i < 36; i++) {
+        // One 32-bit draw covers eight characters
+        if (i % 8 == 0) bits = nextRandom();
+        uint8_t nibble = bits & 15;
+        bits >>= 4;
         switch(i) {
             case 8:
             case 13:
@@ -35,380 +245,1607 @@ String ArduinoMFP::generateUUID() {
                 uuid[i] = '4';
                 break;
             case 19:
-                uuid[i] = hexChars[random(8, 12)];
+                uuid[i] = hexChars[8 | (nibble & 3)];
                 break;
             default:
-                uuid[i] = hexChars[random(0, 16)];
+                uuid[i] = hexChars[nibble];
         }
     }
     uuid[36] = 0;
-    return String(uuid);
-}
-
-String ArduinoMFP::buildCreateScanJobSOAP(const String& messageID, const String& jobUUID, int height, int width, const String& origin, const String& format) {
-    // Use provided params instead of fixed ones
-    return
-    "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
-    "<soap:Envelope xmlns:soap=\"http://www.w3.org/2003/05/soap-envelope\" "
-                   "xmlns:wsa=\"http://schemas.xmlsoap.org/ws/2004/08/addressing\" "
-                   "xmlns:sca=\"http://schemas.microsoft.com/windows/2006/08/wdp/scan\">"
-    "<soap:Header>"
-      "<wsa:To>http://" + messageID + "/WebServices/ScannerService</wsa:To>"  // will fix in scan()
-      "<wsa:Action>http://schemas.microsoft.com/windows/2006/08/wdp/scan/CreateScanJob</wsa:Action>"
-      "<wsa:MessageID>urn:uuid:" + messageID + "</wsa:MessageID>"
-      "<wsa:ReplyTo><wsa:Address>http://schemas.xmlsoap.org/ws/2004/08/addressing/role/anonymous</wsa:Address></wsa:ReplyTo>"
-      "<wsa:From><wsa:Address>urn:uuid:" + jobUUID + "</wsa:Address></wsa:From>"
-    "</soap:Header>"
-    "<soap:Body>"
-      "<sca:CreateScanJobRequest>"
-        "<sca:ScanTicket>"
-          "<sca:JobDescription>"
-            "<sca:JobName>Scan Job</sca:JobName>"
-            "<sca:JobOriginatingUserName>ESP32</sca:JobOriginatingUserName>"
-          "</sca:JobDescription>"
-          "<sca:DocumentParameters>"
-            "<sca:Format sca:MustHonor=\"true\">" + format + "</sca:Format>"
-            "<sca:InputSource sca:MustHonor=\"true\">" + origin + "</sca:InputSource>"
-            "<sca:MediaSides>"
-              "<sca:MediaFront>"
-                "<sca:ColorProcessing>RGB24</sca:ColorProcessing>"
-                "<sca:Resolution><sca:Width>" + String(width) + "</sca:Width><sca:Height>" + String(height) + "</sca:Height></sca:Resolution>"
-              "</sca:MediaFront>"
-            "</sca:MediaSides>"
-          "</sca:DocumentParameters>"
-        "</sca:ScanTicket>"
-      "</sca:CreateScanJobRequest>"
-    "</soap:Body>"
-    "</soap:Envelope>";
-}
-
-String ArduinoMFP::buildRetrieveImageSOAP(const String& messageID, const String& jobUUID, const String& jobId, const String& jobToken) {
-    return
-    "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
-    "<soap:Envelope xmlns:soap=\"http://www.w3.org/2003/05/soap-envelope\" "
-                   "xmlns:wsa=\"http://schemas.xmlsoap.org/ws/2004/08/addressing\" "
-                   "xmlns:sca=\"http://schemas.microsoft.com/windows/2006/08/wdp/scan\">"
-    "<soap:Header>"
-      "<wsa:To>http://" + jobUUID + "/WebServices/ScannerService</wsa:To>"  // fix in scan()
-      "<wsa:Action>http://schemas.microsoft.com/windows/2006/08/wdp/scan/RetrieveImage</wsa:Action>"
-      "<wsa:MessageID>urn:uuid:" + messageID + "</wsa:MessageID>"
-      "<wsa:ReplyTo><wsa:Address>http://schemas.xmlsoap.org/ws/2004/08/addressing/role/anonymous</wsa:Address></wsa:ReplyTo>"
-      "<wsa:From><wsa:Address>urn:uuid:" + jobUUID + "</wsa:Address></wsa:From>"
-    "</soap:Header>"
-    "<soap:Body>"
-      "<sca:RetrieveImageRequest>"
-        "<sca:JobId>" + jobId + "</sca:JobId>"
-        "<sca:JobToken>" + jobToken + "</sca:JobToken>"
-        "<sca:DocumentDescription>"
-          "<sca:DocumentName>Scanned image file for the WSD Scan Driver</sca:DocumentName>"
-        "</sca:DocumentDescription>"
-      "</sca:RetrieveImageRequest>"
-    "</soap:Body>"
-    "</soap:Envelope>";
-}
-
-String ArduinoMFP::sendSoapRequest(const String& host, int port, const String& soapBody) {
-    WiFiClient client;
-    if (!client.connect(host.c_str(), port)) {
-        return "";
-    }
-
-    String request =
-        "POST /WebServices/ScannerService HTTP/1.1\r\n"
-        "Host: " + host + "\r\n"
-        "Content-Type: application/soap+xml\r\n"
-        "Content-Length: " + soapBody.length() + "\r\n"
-        "Connection: close\r\n\r\n" +
-        soapBody;
-
-    client.print(request);
+}
 
-    String response = "";
-    unsigned long timeout = millis();
-    while (client.connected() || client.available()) {
-        if (client.available()) {
-            response += (char)client.read();
-            timeout = millis();
+ArduinoMFP::HttpResult ArduinoMFP::pumpSoap(SoapCall& call, const HttpBodySink& sink, uint32_t budgetMs) {
+    unsigned long start = millis();
+    while (!call.response.complete()) {
+        int avail = call.client->available();
+        if (avail > 0) {
+            int n = call.client->read(ioBuffer, avail < (int)sizeof(ioBuffer) ? avail : sizeof(ioBuffer));
+            if (n > 0) {
+                call.lastData = millis();
+                MFP_STATS(if (!call.gotData) { call.gotData = true; statsCall(call, MFP_PHASE_FIRST_BYTE); });
+                if (!call.response.feed(ioBuffer, n, sink)) return HTTP_RESULT_ERROR;
+                MFP_STATS(if (!call.gotHeaders && call.response.headersDone()) { call.gotHeaders = true; statsCall(call, MFP_PHASE_HEADERS); });
+                MFP_STATS(if (&call == &job.call) statsHeap());
+                if (millis() - start >= budgetMs) return HTTP_RESULT_PENDING;
+                continue;
+            }
         }
-        if (millis() - timeout > 5000) break; // 5s timeout
+        if (!call.client->connected()) {
+            call.response.connectionClosed();
+            break;
+        }
+        if (millis() - call.lastData > responseTimeout) return HTTP_RESULT_TIMEOUT;
+        // Nothing to read yet
+        return HTTP_RESULT_PENDING;
     }
-    client.stop();
+    if (!call.response.complete()) return HTTP_RESULT_ERROR;
+    MFP_STATS(statsCall(call, MFP_PHASE_BODY));
+    return HTTP_RESULT_OK;
+}
 
-    return response;
+void ArduinoMFP::writeHeaders(Print& out, const char* method, const String& host, int port, const char* path, const char* contentType, long contentLength) {
+    out.print(method);
+    out.print(' ');
+    out.print(path);
+    out.print(" HTTP/1.1\r\nHost: ");
+    out.print(host);
+    if (port != 80) {
+        out.print(':');
+        out.print(port);
+    }
+    if (contentType) {
+        out.print("\r\nContent-Type: ");
+        out.print(contentType);
+        if (contentLength < 0) {
+            out.print("\r\nTransfer-Encoding: chunked");
+        } else {
+            out.print("\r\nContent-Length: ");
+            out.print((unsigned long)contentLength);
+        }
+    }
+    out.print(keepAlive ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n");
 }
 
-String ArduinoMFP::extractTag(const String& data, const String& tag) {
-    int start = data.indexOf("<" + tag + ">");
-    int end = data.indexOf("</" + tag + ">");
-    if (start == -1 || end == -1) return "";
-    start += tag.length() + 2;
-    return data.substring(start, end);
+bool ArduinoMFP::writeRequest(Print& out, const char* method, const String& host, int port, const char* path, const char* contentType, const MFPSoapTemplate* body, const MFPSoapSlots& slots) {
+    // Headers and body are rendered straight into the socket through ioBuffer
+    MFPBlockWriter writer(out, ioBuffer, sizeof(ioBuffer));
+    writeHeaders(writer, method, host, port, path, body ? contentType : nullptr, body ? (long)body->length(slots) : 0);
+    if (body) body->write(writer, slots);
+    writer.flush();
+    return !writer.failed();
 }
 
-bool ArduinoMFP::createScanJob(const String& host, int port, int height, int width, const String& origin, const String& format, String& jobUUID, String& jobId, String& jobToken) {
-    jobUUID = generateUUID();
-    String messageID = generateUUID();
+ArduinoMFP::HttpResult ArduinoMFP::startSoap(SoapCall& call, const String& host, int port, const char* path, const MFPSoapTemplate& soap, const MFPSoapSlots& slots) {
+    return startRequest(call, host, port, "POST", path, "application/soap+xml", &soap, slots);
+}
 
-    // Build SOAP with correct URL embedded
-    String soap = buildCreateScanJobSOAP(messageID, jobUUID, height, width, origin, format);
-    soap.replace("http://" + messageID + "/WebServices/ScannerService", "http://" + host + "/WebServices/ScannerService");
+ArduinoMFP::HttpResult ArduinoMFP::startRequest(SoapCall& call, const String& host, int port, const char* method, const char* path, const char* contentType, const MFPSoapTemplate* body, const MFPSoapSlots& slots) {
+    HttpResult result = openRequest(call, host, port);
+    if (result != HTTP_RESULT_PENDING) return result;
+    if (!writeRequest(*call.client, method, host, port, path, contentType, body, slots)) return HTTP_RESULT_ERROR;
+    MFP_STATS(statsCall(call, MFP_PHASE_SENT));
+    return HTTP_RESULT_PENDING;
+}
 
-    String response = sendSoapRequest(host, port, soap);
-    if (response == "") return false;
+ArduinoMFP::HttpResult ArduinoMFP::startIpp(SoapCall& call, const String& host, int port, const char* path, const MFPIppWriter& request, bool chunked) {
+    HttpResult result = openRequest(call, host, port);
+    if (result != HTTP_RESULT_PENDING) return result;
+    MFPBlockWriter writer(*call.client, ioBuffer, sizeof(ioBuffer));
+    writeHeaders(writer, "POST", host, port, path, "application/ipp", chunked ? -1 : (long)request.length());
+    if (chunked) {
+        writer.print((unsigned long)request.length(), HEX);
+        writer.print("\r\n");
+    }
+    writer.write(request.data(), request.length());
+    if (chunked) writer.print("\r\n");
+    writer.flush();
+    if (writer.failed()) return HTTP_RESULT_ERROR;
+    MFP_STATS(if (!chunked) statsCall(call, MFP_PHASE_SENT));
+    return HTTP_RESULT_PENDING;
+}
 
-    jobId = extractTag(response, "wscn:JobId");
-    jobToken = extractTag(response, "wscn:JobToken");
+ArduinoMFP::HttpResult ArduinoMFP::openRequest(SoapCall& call, const String& host, int port) {
+    call.attempt++;
+    MFP_STATS(if (&call == &job.call) { exchangeStart = micros(); stats.exchanges++; });
+    call.client = connections.acquire(host.c_str(), port, connectTimeout, call.reused);
+    if (!call.client) return HTTP_RESULT_CONNECT_FAILED;
+    MFP_STATS(statsCall(call, MFP_PHASE_CONNECTED));
+
+    call.response.begin();
+    call.lastData = millis();
+    MFP_STATS(call.gotData = false);
+    MFP_STATS(call.gotHeaders = false);
+    return HTTP_RESULT_PENDING;
+}
 
-    return (jobId != "" && jobToken != "");
+bool ArduinoMFP::finishSoap(SoapCall& call, HttpResult result) {
+    if (!call.client) return false;
+    connections.release(call.client, keepAlive && result == HTTP_RESULT_OK && call.response.keepAlive());
+    call.client = nullptr;
+
+    // A pooled socket the device already closed fails before any response
+    // arrives; retry once on a fresh connection
+    bool retry = result != HTTP_RESULT_OK && call.reused && call.response.status() == 0 && call.attempt < 2;
+    MFP_STATS(if (retry && &call == &job.call) { stats.retries++; statsPhase(MFP_PHASE_RETRY); });
+    return retry;
 }
 
-bool ArduinoMFP::retrieveImage(const String& host, int port, const String& jobUUID, const String& jobId, const String& jobToken) {
-    String messageID = generateUUID();
-    String soap = buildRetrieveImageSOAP(messageID, jobUUID, jobId, jobToken);
-    soap.replace("http://" + jobUUID + "/WebServices/ScannerService", "http://" + host + "/WebServices/ScannerService");
+ArduinoMFP::HttpResult ArduinoMFP::postSoap(const String& host, int port, const char* path, const MFPSoapTemplate& soap, const MFPSoapSlots& slots, SoapCall& call, const HttpBodySink& sink) {
+    return runCall(call, [&]() {
+        return startSoap(call, host, port, path, soap, slots);
+    }, sink);
+}
 
-    WiFiClient client;
-    if (!client.connect(host.c_str(), port)) return false;
+// Runs one exchange to the end, retrying once when a pooled socket was dead
+ArduinoMFP::HttpResult ArduinoMFP::runCall(SoapCall& call, const std::function<HttpResult()>& start, const HttpBodySink& sink) {
+    HttpResult result;
+    call.attempt = 0;
+    do {
+        result = start();
+        while (result == HTTP_RESULT_PENDING) {
+            result = pumpSoap(call, sink, UINT32_MAX);
+            if (result == HTTP_RESULT_PENDING) delay(1);
+        }
+    } while (finishSoap(call, result));
+    return result;
+}
 
-    String request =
-        "POST /WebServices/ScannerService HTTP/1.1\r\n"
-        "Host: " + host + "\r\n"
-        "Content-Type: application/soap+xml\r\n"
-        "Content-Length: " + soap.length() + "\r\n"
-        "Connection: close\r\n\r\n" +
-        soap;
+ArduinoMFP::HttpResult ArduinoMFP::sendSoapRequest(const String& host, int port, const MFPSoapTemplate& soap, const MFPSoapSlots& slots, MFPXmlParser& xml, const char* path) {
+    SoapCall call;
+    xml.begin();
+    return postSoap(host, port, path, soap, slots, call, [&xml](const uint8_t* data, size_t len) {
+        return xml.feed(data, len);
+    });
+}
 
-    client.print(request);
+size_t ArduinoMFP::getImageSize() const {
+    return imageSize;
+}
 
-    // Read headers to find boundary
-    String boundary = "";
-    unsigned long startTime = millis();
-    bool gotHeaders = false;
+void ArduinoMFP::setMaxImageSize(size_t bytes) {
+    maxImageSize = bytes;
+}
 
-    while (millis() - startTime < 5000) {
-        while (client.available()) {
-            String line = client.readStringUntil('\n');
-            line.trim();
+void ArduinoMFP::setTimeout(uint32_t ms) {
+    responseTimeout = ms;
+}
 
-            if (line.length() == 0) {
-                gotHeaders = true;
-                break;
-            }
+void ArduinoMFP::setConnectTimeout(uint32_t ms) {
+    connectTimeout = ms;
+}
 
-            if (line.startsWith("Content-Type:")) {
-                int bIndex = line.indexOf("boundary=");
-                if (bIndex != -1) {
-                    boundary = line.substring(bIndex + 9);
-                    int semi = boundary.indexOf(';');
-                    if (semi != -1) boundary = boundary.substring(0, semi);
-                    boundary.trim();
-                    boundary.replace("\"", "");
-                }
-            }
-        }
-        if (gotHeaders) break;
-        delay(5);
+void ArduinoMFP::setKeepAlive(bool enable, uint32_t idleMs) {
+    keepAlive = enable;
+    connections.setIdleTimeout(idleMs);
+    if (!enable) connections.closeAll();
+}
+
+void ArduinoMFP::closeConnections() {
+    connections.closeAll();
+}
+
+MFPConnectionPool& ArduinoMFP::getConnectionPool() {
+    return connections;
+}
+
+void ArduinoMFP::setBufferPool(MFPBufferPool* bufferPool) {
+    freeImageBuffer();
+    pool = bufferPool ? bufferPool : &defaultPool;
+}
+
+MFPBufferPool& ArduinoMFP::getBufferPool() {
+    return *pool;
+}
+ 
+uint8_t* ArduinoMFP::getImageBuffer() const {
+    return imageBuffer;
+}
+
+
+uint8_t* ArduinoMFP::scan(int height, int width, const char* origin, const char* url, int port, const char* format, int filesystem) {
+    if (!beginScan(height, width, origin, url, port, format, filesystem)) return nullptr;
+    return finishJob() == MFP_JOB_DONE ? imageBuffer : nullptr;
+}
+
+bool ArduinoMFP::scan(int height, int width, const char* origin, const char* url, int port, const char* format, ScanSink sink) {
+    if (!beginScan(height, width, origin, url, port, format, sink)) return false;
+    return finishJob() == MFP_JOB_DONE;
+}
+
+bool ArduinoMFP::scan(int height, int width, const char* origin, const char* url, int port, const char* format, Print& out) {
+    if (!beginScan(height, width, origin, url, port, format, out)) return false;
+    return finishJob() == MFP_JOB_DONE;
+}
+
+bool ArduinoMFP::beginScan(int height, int width, const char* origin, const char* url, int port, const char* format, int filesystem) {
+    // Buffered mode is a sink that collects the whole image in imageBuffer
+    if (!beginScan(height, width, origin, url, port, format, [this](const uint8_t* data, size_t len) {
+            return appendImage(data, len);
+        })) {
+        return false;
     }
+    freeImageBuffer();
+    job.buffered = true;
+    job.filesystem = filesystem;
+    return true;
+}
 
-    if (boundary == "") {
-        client.stop();
+bool ArduinoMFP::beginScan(int height, int width, const char* origin, const char* url, int port, const char* format, ScanSink sink) {
+    if (!sink || jobActive()) return false;
+    if (!capabilities.check(url, height, width, origin, format)) return false;
+
+    job.host = url;
+    job.port = port;
+    job.height = height;
+    job.width = width;
+    job.origin = origin;
+    job.format = format;
+    job.sink = sink;
+    job.printing = false;
+    job.batch = false;
+    job.buffered = false;
+    job.direct = false;
+    job.filesystem = -1;
+    job.parserStarted = false;
+    job.call.client = nullptr;
+    job.call.attempt = 0;
+    // Inside the event handler, a scan of the subscribed device answers the event (WSD only)
+    job.scanIdentifier = "";
+    job.esclJob = "";
+    if (answering && subscription.host == url && subscription.port == port) job.scanIdentifier = answering->scanIdentifier;
+    job.escl = job.scanIdentifier == "" && useEscl(url, port);
+    job.step = job.escl ? JOB_ESCL_CREATE : JOB_CREATE;
+    job.ticketUsed = false;
+    job.timeFirstByte = false;
+    if (!job.escl && job.scanIdentifier == "") usePrepared();
+    MFP_STATS(statsBegin(false));
+    return true;
+}
+
+bool ArduinoMFP::beginScan(int height, int width, const char* origin, const char* url, int port, const char* format, Print& out) {
+    return beginScan(height, width, origin, url, port, format, [&out](const uint8_t* data, size_t len) {
+        return out.write(data, len) == len;
+    });
+}
+
+bool ArduinoMFP::scan(int height, int width, const char* origin, const char* url, int port, const char* format, int filesystem, const char* path) {
+    if (!beginScan(height, width, origin, url, port, format, filesystem, path)) return false;
+    return finishJob() == MFP_JOB_DONE;
+}
+
+bool ArduinoMFP::beginScan(int height, int width, const char* origin, const char* url, int port, const char* format, int filesystem, const char* path) {
+    if ((filesystem != 0 && filesystem != 1) || !path || jobActive()) return false;
+    fs::FS& fs = fileSystem(filesystem);
+
+    size_t free = freeSpace(filesystem);
+    if (free < (maxImageSize ? maxImageSize : minFreeSpace)) {
+        Serial.println("Not enough free space for the scan");
         return false;
     }
+    char name[64];
+    if (!nextPath(fs, path, name, sizeof(name))) {
+        Serial.println("No free file name for the scan");
+        return false;
+    }
+    File file = fs.open(name, FILE_WRITE);
+    if (!file) {
+        Serial.println("Failed to open file for writing");
+        return false;
+    }
+    if (!job.writer.begin(file, *pool)) {
+        file.close();
+        fs.remove(name);
+        return false;
+    }
+    if (!beginScan(height, width, origin, url, port, format, [this](const uint8_t* data, size_t len) {
+            return job.writer.write(data, len);
+        })) {
+        job.writer.abort();
+        fs.remove(name);
+        return false;
+    }
+    job.direct = true;
+    job.filesystem = filesystem;
+    job.path = name;
+    job.freeSpace = free;
+    return true;
+}
 
-    String boundaryStart = "--" + boundary;
-    String boundaryEnd = boundaryStart + "--";
+void ArduinoMFP::setMinFreeSpace(size_t bytes) {
+    minFreeSpace = bytes;
+}
 
-    bool foundImagePart = false;
-    bool readingImage = false;
+const String& ArduinoMFP::getLastPath() const {
+    return job.path;
+}
 
-    // Buffer for accumulating image data - realloc as needed
-    freeImageBuffer();
+void ArduinoMFP::dropDirectFile() {
+    // A failed or cancelled direct-to-flash scan leaves no partial file behind
+    if (!job.direct) return;
+    job.writer.abort();
+    fileSystem(job.filesystem).remove(job.path.c_str());
+    job.direct = false;
+}
 
-    const size_t bufferChunk = 1024;
-    size_t allocSize = bufferChunk;
-    imageBuffer = new uint8_t[allocSize];
-    imageSize = 0;
+int ArduinoMFP::scanBatch(int height, int width, const char* origin, const char* url, int port, const char* format, PageSink sink) {
+    if (!beginBatchScan(height, width, origin, url, port, format, sink)) return 0;
+    finishJob();
+    return batchStats.pages;
+}
 
-    while (client.connected() || client.available()) {
-        String line = client.readStringUntil('\n');
-        line.trim();
-
-        if (line == boundaryStart) {
-            foundImagePart = false;
-            readingImage = false;
-        } else if (line.startsWith("Content-Type: image/jpeg")) {
-            foundImagePart = true;
-        } else if (foundImagePart && line == "") {
-            readingImage = true;
-        } else if (line == boundaryEnd) {
-            break;
-        } else if (readingImage) {
-            // binary data starts here
-            break;
-        }
+int ArduinoMFP::scanBatch(int height, int width, const char* origin, const char* url, int port, const char* format, int filesystem, const char* pathTemplate) {
+    if (!beginBatchScan(height, width, origin, url, port, format, filesystem, pathTemplate)) return 0;
+    finishJob();
+    return batchStats.pages;
+}
+
+bool ArduinoMFP::beginBatchScan(int height, int width, const char* origin, const char* url, int port, const char* format, PageSink sink) {
+    if (!sink) return false;
+    if (!beginScan(height, width, origin, url, port, format, [this](const uint8_t* data, size_t len) {
+            return job.pageSink(batchStats.pages + 1, data, len);
+        })) {
+        return false;
+    }
+    job.pageSink = sink;
+    startBatch();
+    return true;
+}
+
+bool ArduinoMFP::beginBatchScan(int height, int width, const char* origin, const char* url, int port, const char* format, int filesystem, const char* pathTemplate) {
+    if ((filesystem != 0 && filesystem != 1) || !pathTemplate) return false;
+    // Each page is collected in imageBuffer and written while the next one is requested
+    if (!beginScan(height, width, origin, url, port, format, filesystem)) return false;
+    job.pathTemplate = pathTemplate;
+    startBatch();
+    return true;
+}
+
+void ArduinoMFP::startBatch() {
+    job.batch = true;
+    job.pageReady = false;
+    job.failAfterPage = nullptr;
+    job.batchStart = millis();
+    batchStats.pages = 0;
+    batchStats.bytes = 0;
+    batchStats.millis = 0;
+    batchStats.kbPerSec = 0;
+}
+
+void ArduinoMFP::onPage(PageDoneHandler handler) {
+    pageHandler = handler;
+}
+
+const MFPBatchStats& ArduinoMFP::getBatchStats() const {
+    return batchStats;
+}
+
+bool ArduinoMFP::addStage(MFPStage& stage) {
+    if (stageCount >= MFP_MAX_STAGES || jobActive()) return false;
+    stages[stageCount++] = &stage;
+    return true;
+}
+
+void ArduinoMFP::clearStages() {
+    if (!jobActive()) stageCount = 0;
+}
+
+void ArduinoMFP::setScanProtocol(MFPScanProtocol protocol) {
+    scanProtocol = protocol;
+}
+
+MFPScanProtocol ArduinoMFP::getScanProtocol() const {
+    return scanProtocol;
+}
+
+bool ArduinoMFP::useEscl(const char* url, int port) {
+    if (scanProtocol != MFP_SCAN_AUTO) return scanProtocol == MFP_SCAN_ESCL;
+    // Only the discovery cache is consulted; an unknown device gets WSD as before
+    MFPDevice device;
+    if (!discovery.getDevice(url, device)) return false;
+    const uint8_t escl = MFP_SERVICE_ESCL | MFP_SERVICE_AIRSCAN | MFP_SERVICE_USCANNER;
+    for (int i = 0; i < MFP_SERVICE_COUNT; i++) {
+        if ((device.services & escl & (1 << i)) && device.ports[i] == port) return true;
     }
+    return false;
+}
 
-    if (!readingImage) {
-        freeImageBuffer();
-        client.stop();
+bool ArduinoMFP::subscribeScans(const char* url, int port, ScanEventHandler handler, const char* displayName, uint16_t listenPort, uint32_t expiresSec) {
+    if (!handler || !url) return false;
+    unsubscribeScans();
+    subscription.host = url;
+    subscription.port = port;
+    subscription.displayName = displayName ? displayName : "ESP32";
+    subscription.listenPort = listenPort;
+    subscription.requested = expiresSec;
+    subscription.handler = handler;
+    subscription.eventPending = false;
+    generateUUID(subscription.identifier);
+
+    // Listening before subscribing: the device may deliver right away
+    eventServer.begin(listenPort);
+    if (!sendSubscribe()) {
+        eventServer.end();
         return false;
     }
+    subscription.active = true;
+    return true;
+}
 
-    // Read raw binary JPEG data until boundary found again
-    const int bLen = boundaryStart.length();
-    char* buf = new char[bLen + 4];
-    int bufIdx = 0;
+bool ArduinoMFP::sendSubscribe() {
+    // Posted to the scanner service address from the device metadata (cached)
+    MFPCapabilities caps;
+    if (!getCapabilities(subscription.host.c_str(), subscription.port, caps)) {
+        Serial.println("Failed to read device metadata");
+        return false;
+    }
+    String serviceHost;
+    int servicePort;
+    String path;
+    scannerService(caps.info.services.scanner, subscription.host.c_str(), subscription.port, serviceHost, servicePort, path);
+
+    char messageID[37];
+    generateUUID(messageID);
+    String notifyTo = "http://" + WiFi.localIP().toString() + ":" + String(subscription.listenPort) + "/" + subscription.identifier;
+
+    MFPSoapSlots slots;
+    slots.set(SOAP_HOST, subscription.host);
+    slots.set(SOAP_MESSAGE_ID, messageID, 36);
+    slots.set(SOAP_FROM, subscription.identifier, 36);
+    slots.set(SOAP_ADDRESS, notifyTo);
+    slots.set(SOAP_IDENTIFIER, subscription.identifier, 36);
+    slots.set(SOAP_EXPIRES, (long)subscription.requested);
+    slots.set(SOAP_DISPLAY_NAME, subscription.displayName);
+
+    bool answered = false;
+    String fault;
+    String manager;
+    String managerId;
+    String token;
+    uint32_t granted = 0;
+    MFPXmlParser xml;
+    int responseTag = xml.watch("SubscribeResponse");
+    int managerTag = xml.watch("SubscriptionManager/Address");
+    int managerIdTag = xml.watch("SubscriptionManager/ReferenceParameters/Identifier");
+    int expiresTag = xml.watch("SubscribeResponse/Expires");
+    int tokenTag = xml.watch("DestinationResponse/DestinationToken");
+    int faultTag = xml.watch("Subcode/Value");
+    xml.onValue([&](int id, const char* text, size_t len) {
+        if (id == responseTag) answered = true;
+        else if (id == managerTag) manager = text;
+        else if (id == managerIdTag) managerId = text;
+        else if (id == expiresTag) granted = parseDuration(text);
+        else if (id == tokenTag) token = text;
+        else if (id == faultTag) fault = text;
+    });
+
+    HttpResult result = sendSoapRequest(serviceHost, servicePort, MFPSubscribeSoap, slots, xml, path.c_str());
+    if (result != HTTP_RESULT_OK || !answered) {
+        Serial.println("Subscribe failed: " + fault);
+        return false;
+    }
+    // Without a manager address, Renew goes to the service itself
+    if (manager == "") manager = "http://" + serviceHost + ":" + String(servicePort) + path;
+    subscription.manager = manager;
+    subscription.managerId = managerId;
+    subscription.destinationToken = token;
+    // An absolute expiry time cannot be read without a clock; assume what was asked for
+    subscription.expires = granted ? granted : subscription.requested;
+    if (subscription.expires > 86400) subscription.expires = 86400;
+    subscription.renewedAt = millis();
+    return true;
+}
 
-    while (client.connected() || client.available()) {
-        if (!client.available()) {
-            delay(1);
-            continue;
-        }
-        char c = client.read();
-        buf[bufIdx++] = c;
-
-        if (bufIdx == bLen) {
-            buf[bufIdx] = 0;
-            String bufStr = String(buf).substring(0, bufIdx);
-            if (bufStr == boundaryStart || bufStr == boundaryEnd) {
-                // boundary reached - done reading image
-                break;
-            }
+bool ArduinoMFP::renewScans() {
+    String host;
+    int port;
+    String path;
+    if (!splitUrl(subscription.manager, host, port, path)) return false;
+
+    char messageID[37];
+    generateUUID(messageID);
+    MFPSoapSlots slots;
+    slots.set(SOAP_ADDRESS, subscription.manager);
+    slots.set(SOAP_MESSAGE_ID, messageID, 36);
+    slots.set(SOAP_IDENTIFIER, subscription.managerId);
+    slots.set(SOAP_EXPIRES, (long)subscription.requested);
+
+    bool answered = false;
+    uint32_t granted = 0;
+    MFPXmlParser xml;
+    int responseTag = xml.watch("RenewResponse");
+    int expiresTag = xml.watch("RenewResponse/Expires");
+    xml.onValue([&](int id, const char* text, size_t len) {
+        if (id == responseTag) answered = true;
+        else if (id == expiresTag) granted = parseDuration(text);
+    });
+    if (sendSoapRequest(host, port, MFPRenewSoap, slots, xml, path.c_str()) != HTTP_RESULT_OK || !answered) return false;
+    subscription.expires = granted ? granted : subscription.requested;
+    if (subscription.expires > 86400) subscription.expires = 86400;
+    subscription.renewedAt = millis();
+    return true;
+}
 
-            // write first char to image buffer
-            if (imageSize + 1 > allocSize) {
-                // realloc buffer bigger
-                allocSize += bufferChunk;
-                uint8_t* newBuffer = new uint8_t[allocSize];
-                memcpy(newBuffer, imageBuffer, imageSize);
-                delete[] imageBuffer;
-                imageBuffer = newBuffer;
-            }
-            imageBuffer[imageSize++] = (uint8_t)buf[0];
+void ArduinoMFP::sendUnsubscribe() {
+    String host;
+    int port;
+    String path;
+    if (!splitUrl(subscription.manager, host, port, path)) return;
+
+    char messageID[37];
+    generateUUID(messageID);
+    MFPSoapSlots slots;
+    slots.set(SOAP_ADDRESS, subscription.manager);
+    slots.set(SOAP_MESSAGE_ID, messageID, 36);
+    slots.set(SOAP_IDENTIFIER, subscription.managerId);
+    MFPXmlParser xml;
+    sendSoapRequest(host, port, MFPUnsubscribeSoap, slots, xml, path.c_str());
+}
+
+void ArduinoMFP::unsubscribeScans() {
+    if (!subscription.active) return;
+    // Best effort; a device that is gone drops the subscription when it expires
+    sendUnsubscribe();
+    if (subscription.receiving) subscription.delivery.stop();
+    subscription.receiving = false;
+    eventServer.end();
+    subscription.active = false;
+    subscription.eventPending = false;
+}
+
+bool ArduinoMFP::scansSubscribed() const {
+    return subscription.active;
+}
+
+void ArduinoMFP::handleEvents() {
+    if (!subscription.active) return;
+
+    // Renewed at 80 % of the granted time; a device that forgot the subscription
+    // (e.g. after a reboot) refuses the Renew and gets a new Subscribe
+    if (millis() - subscription.renewedAt >= subscription.expires * 800UL) {
+        if (!renewScans() && !sendSubscribe()) {
+            Serial.println("Scan subscription not renewed");
+            subscription.renewedAt += 10000;  // try again in 10 s
+        }
+    }
 
-            // shift left buffer by 1
-            memmove(buf, buf + 1, bufIdx - 1);
-            bufIdx--;
+    // One delivery at a time; the next one waits in the listen backlog
+    if (!subscription.receiving) {
+        WiFiClient client = eventServer.available();
+        if (client) {
+            subscription.delivery = client;
+            subscription.receiving = true;
+            subscription.deliveryData = millis();
+            memset(&subscription.incoming, 0, sizeof(subscription.incoming));
+            subscription.deliveredTo[0] = 0;
+            subscription.request.beginRequest();
+            subscription.xml.begin();
         }
     }
-    delete[] buf;
+    if (subscription.receiving && readEvent()) subscription.eventPending = true;
+
+    // An event that arrives during a job is answered once the job is over
+    if (subscription.eventPending && !jobActive()) {
+        subscription.eventPending = false;
+        MFPScanEvent event = subscription.event;
+        answering = &event;
+        subscription.handler(event);
+        answering = nullptr;
+    }
+}
 
-    client.stop();
+// Takes only what the delivery has sent so far, so a slow or stray connection
+// does not hold up loop(); true once a complete event is in subscription.event
+bool ArduinoMFP::readEvent() {
+    Subscription& s = subscription;
+    bool bad = false;
+    int avail = s.delivery.available();
+    while (avail > 0 && !s.request.complete() && !bad) {
+        int n = s.delivery.read(ioBuffer, avail < (int)sizeof(ioBuffer) ? avail : sizeof(ioBuffer));
+        if (n <= 0) break;
+        avail -= n;
+        s.deliveryData = millis();
+        bad = !s.request.feed(ioBuffer, n, [&s](const uint8_t* data, size_t len) { return s.xml.feed(data, len); });
+    }
+    if (!s.request.complete() && !bad) {
+        if (!s.delivery.connected()) s.request.connectionClosed();
+        else if (millis() - s.deliveryData <= responseTimeout) return false;  // more to come
+    }
 
-    return imageSize > 0;
+    // Every delivery is acknowledged, so the device does not send it again
+    bool complete = s.request.complete();
+    s.delivery.print(complete ? "HTTP/1.1 202 Accepted\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+                              : "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+    s.delivery.stop();
+    s.receiving = false;
+    if (!complete || !s.incoming.scanIdentifier[0]) return false;
+    // Deliveries for an earlier subscription carry another identifier
+    if (s.deliveredTo[0] && !strstr(s.deliveredTo, s.identifier)) return false;
+
+    strlcpy(s.incoming.host, s.host.c_str(), sizeof(s.incoming.host));
+    s.incoming.port = s.port;
+    s.incoming.receivedAt = millis();
+    s.event = s.incoming;
+    return true;
 }
 
-size_t ArduinoMFP::getImageSize() const {
-    return imageSize;
+bool ArduinoMFP::prepareScan(int height, int width, const char* origin, const char* url, int port, const char* format, uint32_t holdMs, uint32_t refreshMs) {
+    if (jobActive()) return false;
+    if (!capabilities.check(url, height, width, origin, format)) return false;
+    // eSCL starts scanning as soon as the job exists, so there is nothing to hold
+    if (useEscl(url, port)) {
+        Serial.println("Prepared scans need WSD");
+        return false;
+    }
+    cancelPrepared();
+    prepared.host = url;
+    prepared.port = port;
+    prepared.height = height;
+    prepared.width = width;
+    prepared.origin = origin;
+    prepared.format = format;
+    prepared.holdMs = holdMs;
+    prepared.refreshMs = refreshMs;
+    prepared.usedAt = millis();
+    if (!createTicket()) return false;
+    prepared.armed = true;
+    return true;
 }
- 
-uint8_t* ArduinoMFP::getImageBuffer() const {
-    return imageBuffer;
+
+void ArduinoMFP::cancelPrepared() {
+    cancelTicket();
+    prepared.armed = false;
 }
 
+bool ArduinoMFP::scanPrepared() const {
+    return prepared.armed && prepared.ticket;
+}
 
-uint8_t* ArduinoMFP::scan(int height, int width, const char* origin, const char* url, int port, const char* format, int filesystem = -1) {
-    freeImageBuffer();
-    imageSize = 0;
+const MFPPreparedStats& ArduinoMFP::getPreparedStats() const {
+    return preparedStats;
+}
+
+void ArduinoMFP::handlePrepared() {
+    // While a scan runs the next ticket waits; the device only takes one job at a time
+    if (!prepared.armed || jobActive()) return;
+    unsigned long now = millis();
+    if (now - prepared.usedAt >= prepared.holdMs) {
+        cancelPrepared();
+        return;
+    }
+    if (!prepared.ticket) {
+        if ((long)(now - prepared.retryAt) >= 0) createTicket();
+        return;
+    }
+    // A fresh job replaces the old one before the device times it out
+    if (now - prepared.createdAt >= prepared.refreshMs) {
+        cancelTicket();
+        if (createTicket()) preparedStats.refreshes++;
+    }
+}
 
-    String host(url);
+bool ArduinoMFP::createTicket() {
+    generateUUID(prepared.uuid);
+    char messageID[37];
+    generateUUID(messageID);
+
+    MFPSoapSlots slots;
+    slots.set(SOAP_HOST, prepared.host);
+    slots.set(SOAP_MESSAGE_ID, messageID, 36);
+    slots.set(SOAP_FROM, prepared.uuid, 36);
+    slots.set(SOAP_FORMAT, prepared.format);
+    slots.set(SOAP_ORIGIN, prepared.origin);
+    slots.set(SOAP_WIDTH, (long)prepared.width);
+    slots.set(SOAP_HEIGHT, (long)prepared.height);
+
+    String id;
+    String token;
+    MFPXmlParser xml;
+    int idTag = xml.watch("CreateScanJobResponse/JobId");
+    int tokenTag = xml.watch("CreateScanJobResponse/JobToken");
+    xml.onValue([&](int tag, const char* text, size_t len) {
+        if (tag == idTag) id = text;
+        else if (tag == tokenTag) token = text;
+    });
+    unsigned long start = millis();
+    if (sendSoapRequest(prepared.host, prepared.port, MFPCreateScanJobSoap, slots, xml) != HTTP_RESULT_OK || id == "" || token == "") {
+        Serial.println("Failed to prepare scan job");
+        prepared.retryAt = millis() + 5000;
+        return false;
+    }
+    prepared.createMillis = millis() - start;
+    prepared.id = id;
+    prepared.token = token;
+    prepared.ticket = true;
+    prepared.createdAt = millis();
+    preparedStats.tickets++;
+    return true;
+}
 
-    String jobUUID, jobId, jobToken;
+void ArduinoMFP::cancelTicket() {
+    if (!prepared.ticket) return;
+    prepared.ticket = false;
+    char messageID[37];
+    generateUUID(messageID);
+
+    MFPSoapSlots slots;
+    slots.set(SOAP_HOST, prepared.host);
+    slots.set(SOAP_MESSAGE_ID, messageID, 36);
+    slots.set(SOAP_FROM, prepared.uuid, 36);
+    slots.set(SOAP_JOB_ID, prepared.id);
+    // A fault is fine too: the device may have dropped the job already
+    MFPXmlParser xml;
+    sendSoapRequest(prepared.host, prepared.port, MFPCancelJobSoap, slots, xml);
+}
 
-    if (!createScanJob(host, port, height, width, String(origin), String(format), jobUUID, jobId, jobToken)) {
-        return nullptr;
+// A scan of the prepared device takes the ticket if its settings match;
+// any other scan needs the device, so the ticket is cancelled
+void ArduinoMFP::usePrepared() {
+    if (!prepared.armed || prepared.host != job.host || prepared.port != job.port) return;
+    job.scanStart = millis();
+    job.timeFirstByte = true;
+    prepared.retryAt = millis();
+    if (!prepared.ticket || prepared.height != job.height || prepared.width != job.width || prepared.origin != job.origin || prepared.format != job.format) {
+        cancelTicket();
+        return;
     }
+    memcpy(job.uuid, prepared.uuid, sizeof(job.uuid));
+    job.id = prepared.id;
+    job.token = prepared.token;
+    job.ticketUsed = true;
+    job.step = JOB_RETRIEVE;
+    prepared.ticket = false;
+    prepared.usedAt = millis();
+}
 
-    if (!retrieveImage(host, port, jobUUID, jobId, jobToken)) {
-        return nullptr;
+// Counted when the image starts, so a ticket the device had dropped counts as a miss
+void ArduinoMFP::preparedFirstByte() {
+    job.timeFirstByte = false;
+    float ms = millis() - job.scanStart;
+    MFPPreparedStats& st = preparedStats;
+    if (job.ticketUsed) {
+        st.hits++;
+        st.savedMillis += prepared.createMillis;
+        st.hitFirstByteMs += (ms - st.hitFirstByteMs) / st.hits;
+    } else {
+        st.misses++;
+        st.missFirstByteMs += (ms - st.missFirstByteMs) / st.misses;
     }
+    st.hitRate = st.hits / (float)(st.hits + st.misses);
+}
 
-    if (filesystem == 0 || filesystem == 1) {
-        File filePtr;
+// eSCL wants a MIME type; WSD format names are mapped, anything else passes through
+const char* ArduinoMFP::esclFormat(const String& format) {
+    return MFPCapabilityCache::mimeType(format.c_str());
+}
 
-        if (filesystem == 0) {
-            filePtr = SPIFFS.open("/scan.jpg", FILE_WRITE);
-        } else {
-            filePtr = LittleFS.open("/scan.jpg", FILE_WRITE);
+bool ArduinoMFP::beginPrint(const char* url, int port, String payload) {
+    if (jobActive()) return false;
+    // The "\n\f" trailer is added while sending
+    long total = payload.length() + 2;
+    job.payload = std::move(payload);
+    return beginPrint(url, port, [this](uint8_t* buffer, size_t size) {
+        return readText(job.payload, job.textOffset, buffer, size);
+    }, total, true);
+}
+
+PrintSource ArduinoMFP::streamSource(Stream& data) {
+    return [&data](uint8_t* buffer, size_t size) -> size_t {
+        // Sends until the stream runs dry, which suits File and memory streams
+        int avail = data.available();
+        if (avail <= 0) return 0;
+        return data.readBytes(buffer, (size_t)avail < size ? (size_t)avail : size);
+    };
+}
+
+bool ArduinoMFP::beginPrint(const char* url, int port, Stream& data) {
+    int total = data.available();
+    return beginPrint(url, port, streamSource(data), total > 0 ? total : -1, false);
+}
+
+bool ArduinoMFP::beginPrint(const char* url, int port, PrintSource source) {
+    return beginPrint(url, port, source, -1, false);
+}
+
+bool ArduinoMFP::beginPrint(const char* url, int port, PrintSource source, long total, bool collectReply) {
+    if (!source || jobActive()) return false;
+
+    size_t capacity;
+    job.block = pool->acquire(MFP_BLOCK_SIZE, capacity);
+    if (!job.block) return false;
+
+    job.host = url;
+    job.port = port;
+    job.printing = true;
+    job.batch = false;
+    job.buffered = false;
+    job.direct = false;
+    job.escl = false;
+    job.ipp = false;
+    job.ippJobId = 0;
+    job.source = source;
+    job.collectReply = collectReply;
+    job.printTotal = total;
+    job.textOffset = 0;
+    job.blockLen = 0;
+    job.blockSent = 0;
+    job.sent = 0;
+    job.output = "";
+    printStats = MFPPrintStats{0, 0, 0};
+    job.step = JOB_PRINT_CONNECT;
+    MFP_STATS(statsBegin(true));
+    return true;
+}
+
+size_t ArduinoMFP::readText(const String& text, size_t& offset, uint8_t* buffer, size_t size) {
+    static const char trailer[] = "\n\f";
+    size_t length = text.length();
+    size_t n = 0;
+    while (n < size && offset < length + 2) {
+        buffer[n++] = offset < length ? text[offset] : trailer[offset - length];
+        offset++;
+    }
+    return n;
+}
+
+const MFPPrintStats& ArduinoMFP::getPrintStats() const {
+    return printStats;
+}
+
+int ArduinoMFP::printIpp(const char* url, int port, Stream& data, const char* format, const char* path) {
+    if (!beginIppPrint(url, port, data, format, path)) return 0;
+    return finishJob() == MFP_JOB_DONE ? job.ippJobId : 0;
+}
+
+int ArduinoMFP::printIpp(const char* url, int port, PrintSource source, const char* format, const char* path) {
+    if (!beginIppPrint(url, port, source, format, path)) return 0;
+    return finishJob() == MFP_JOB_DONE ? job.ippJobId : 0;
+}
+
+bool ArduinoMFP::beginIppPrint(const char* url, int port, Stream& data, const char* format, const char* path) {
+    if (!format || !path) return false;
+    int total = data.available();
+    if (!beginPrint(url, port, streamSource(data), total > 0 ? total : -1, false)) return false;
+    startIppJob(format, path);
+    return true;
+}
+
+bool ArduinoMFP::beginIppPrint(const char* url, int port, PrintSource source, const char* format, const char* path) {
+    if (!format || !path || !beginPrint(url, port, source, -1, false)) return false;
+    startIppJob(format, path);
+    return true;
+}
+
+// Turns the print job beginPrint() just set up into an IPP Print-Job
+void ArduinoMFP::startIppJob(const char* format, const char* path) {
+    job.ipp = true;
+    job.ippFormat = format;
+    job.ippPath = path;
+    job.call.client = nullptr;
+    job.call.attempt = 0;
+    job.step = JOB_IPP_CONNECT;
+}
+
+int ArduinoMFP::getIppJobId() const {
+    return job.ippJobId;
+}
+
+MFPIppJobState ArduinoMFP::getIppJobState(const char* url, int port, int jobId, const char* path) {
+    uint8_t buffer[256];
+    MFPIppWriter request(buffer, sizeof(buffer));
+    request.begin(MFP_IPP_GET_JOB_ATTRIBUTES, ++ippRequestId);
+    request.printerUri(url, port, path);
+    request.integer(MFP_IPP_TAG_INTEGER, "job-id", jobId);
+    request.text(MFP_IPP_TAG_NAME, "requesting-user-name", "ArduinoMFP");
+    request.text(MFP_IPP_TAG_KEYWORD, "requested-attributes", "job-state");
+    request.end();
+    if (request.failed()) return MFP_IPP_UNKNOWN;
+
+    SoapCall call;
+    MFPIppResponse response;
+    String host = url;
+    HttpResult result = runCall(call, [&]() {
+        return startIpp(call, host, port, path, request, false);
+    }, [&response](const uint8_t* data, size_t len) {
+        return response.feed(data, len);
+    });
+    if (result != HTTP_RESULT_OK || call.response.status() != 200 || !response.ok()) return MFP_IPP_UNKNOWN;
+    return response.jobState();
+}
+
+MFPJobState ArduinoMFP::poll() {
+    unsigned long start = millis();
+    while (jobActive()) {
+        uint32_t elapsed = millis() - start;
+        if (elapsed >= pollBudget) break;
+        // A step returns false when it has to wait for the network
+        if (!stepJob(pollBudget - elapsed)) break;
+    }
+    MFP_STATS(if (!jobActive()) statsEnd());
+    return getJobState();
+}
+
+MFPJobState ArduinoMFP::getJobState() const {
+    switch (job.step) {
+    case JOB_IDLE:
+        return MFP_JOB_IDLE;
+    case JOB_DONE:
+        return MFP_JOB_DONE;
+    case JOB_FAILED:
+        return MFP_JOB_FAILED;
+    default:
+        return MFP_JOB_RUNNING;
+    }
+}
+
+void ArduinoMFP::cancelJob() {
+    if (!jobActive()) return;
+    // An eSCL job being created exists on the device; its path is needed to delete it
+    while (job.step == JOB_ESCL_CREATE_READ) {
+        if (!stepJob(UINT32_MAX)) delay(1);
+    }
+    if (job.call.client) {
+        connections.release(job.call.client, false);
+        job.call.client = nullptr;
+    }
+    if (job.file) job.file.close();
+    dropDirectFile();
+    endPrint();
+    deleteEsclJob();
+    // A partly received image is of no use; the pool gets the buffer back
+    if (job.buffered) freeImageBuffer();
+    job.step = JOB_IDLE;
+    MFP_STATS(statsEnd());
+}
+
+size_t ArduinoMFP::getJobBytes() const {
+    if (job.printing) return job.sent;
+    return jobImageBytes();
+}
+
+long ArduinoMFP::getJobTotal() const {
+    if (job.printing) return job.printTotal;
+    return jobImageLength();
+}
+
+size_t ArduinoMFP::jobImageBytes() const {
+    if (!job.parserStarted) return 0;
+    return job.escl ? job.bodyBytes : job.parser.imageBytes();
+}
+
+long ArduinoMFP::jobImageLength() const {
+    if (!job.parserStarted) return -1;
+    return job.escl ? job.call.response.contentLength() : job.parser.imageLength();
+}
+
+const String& ArduinoMFP::getPrintOutput() const {
+    return job.output;
+}
+
+void ArduinoMFP::setPollBudget(uint32_t ms) {
+    pollBudget = ms ? ms : 1;
+}
+
+bool ArduinoMFP::jobActive() const {
+    return job.step != JOB_IDLE && job.step != JOB_DONE && job.step != JOB_FAILED;
+}
+
+MFPJobState ArduinoMFP::finishJob() {
+    // Blocking calls run the job with no budget and sleep only while waiting for data
+    while (jobActive()) {
+        if (!stepJob(UINT32_MAX)) delay(1);
+    }
+    MFP_STATS(statsEnd());
+    return getJobState();
+}
+
+bool ArduinoMFP::failJob(const char* message) {
+    if (message) Serial.println(message);
+    if (job.call.client) {
+        connections.release(job.call.client, false);
+        job.call.client = nullptr;
+    }
+    if (job.file) job.file.close();
+    dropDirectFile();
+    endPrint();
+    deleteEsclJob();
+    if (job.buffered && job.step != JOB_SAVE) freeImageBuffer();
+    job.step = JOB_FAILED;
+    return false;
+}
+
+// A job that ends early is deleted at once, best effort; a finished one goes
+// through JOB_ESCL_DELETE
+void ArduinoMFP::deleteEsclJob() {
+    if (job.esclJob == "") return;
+    String path = job.esclJob;
+    job.esclJob = "";
+    SoapCall call;
+    MFPSoapSlots slots;
+    runCall(call, [&]() {
+        return startRequest(call, job.host, job.port, "DELETE", path.c_str(), nullptr, nullptr, slots);
+    }, [](const uint8_t*, size_t) {
+        return true;
+    });
+}
+
+bool ArduinoMFP::stepJob(uint32_t budgetMs) {
+    switch (job.step) {
+    case JOB_CREATE: {
+        generateUUID(job.uuid);
+        char messageID[37];
+        generateUUID(messageID);
+
+        MFPSoapSlots slots;
+        slots.set(SOAP_HOST, job.host);
+        slots.set(SOAP_MESSAGE_ID, messageID, 36);
+        slots.set(SOAP_FROM, job.uuid, 36);
+        slots.set(SOAP_FORMAT, job.format);
+        slots.set(SOAP_ORIGIN, job.origin);
+        slots.set(SOAP_WIDTH, (long)job.width);
+        slots.set(SOAP_HEIGHT, (long)job.height);
+        bool event = job.scanIdentifier != "";
+        if (event) {
+            slots.set(SOAP_SCAN_IDENTIFIER, job.scanIdentifier);
+            slots.set(SOAP_DESTINATION_TOKEN, subscription.destinationToken);
         }
 
-        if (!filePtr) {
-            Serial.println("Failed to open file for writing");
-            return nullptr;
+        job.id = "";
+        job.token = "";
+        job.xml.begin();
+        HttpResult result = startSoap(job.call, job.host, job.port, "/WebServices/ScannerService", event ? MFPCreateEventScanJobSoap : MFPCreateScanJobSoap, slots);
+        if (result != HTTP_RESULT_PENDING) return soapFailed(result, JOB_CREATE);
+        job.step = JOB_CREATE_READ;
+        return true;
+    }
+
+    case JOB_CREATE_READ: {
+        HttpResult result = pumpSoap(job.call, [this](const uint8_t* data, size_t len) {
+            return job.xml.feed(data, len);
+        }, budgetMs);
+        if (result == HTTP_RESULT_PENDING) return false;
+        if (result != HTTP_RESULT_OK) return soapFailed(result, JOB_CREATE);
+        finishSoap(job.call, result);
+        if (job.id == "" || job.token == "") return failJob("CreateScanJob failed");
+
+        job.call.attempt = 0;
+        job.step = JOB_RETRIEVE;
+        return true;
+    }
+
+    case JOB_RETRIEVE: {
+        char messageID[37];
+        generateUUID(messageID);
+
+        MFPSoapSlots slots;
+        slots.set(SOAP_HOST, job.host);
+        slots.set(SOAP_MESSAGE_ID, messageID, 36);
+        slots.set(SOAP_FROM, job.uuid, 36);
+        slots.set(SOAP_JOB_ID, job.id);
+        slots.set(SOAP_JOB_TOKEN, job.token);
+
+        expectedImageSize = 0;
+        job.parserStarted = false;
+        job.stagesStarted = false;
+        job.faultBody = false;
+        job.fault = "";
+        job.pageStart = millis();
+        HttpResult result = startSoap(job.call, job.host, job.port, "/WebServices/ScannerService", MFPRetrieveImageSoap, slots);
+        if (result != HTTP_RESULT_PENDING) return soapFailed(result, JOB_RETRIEVE);
+        // The previous page is handed off while the device prepares the next one
+        if (job.pageReady) job.step = job.buffered ? JOB_SAVE : JOB_PAGE_DONE;
+        else job.step = JOB_RETRIEVE_READ;
+        return true;
+    }
+
+    case JOB_RETRIEVE_READ: {
+        // The body is handed over in blocks as it arrives; the parser finds the
+        // boundaries and feeds the image part to the sink
+        HttpResult result = pumpSoap(job.call, [this](const uint8_t* data, size_t len) {
+            if (!job.parserStarted && !job.faultBody) {
+                String boundary = job.call.response.boundary();
+                if (boundary == "") {
+                    // No multipart body: a SOAP fault
+                    job.faultBody = true;
+                    job.xml.begin();
+                } else {
+                    job.parserStarted = true;
+                    if (!job.parser.begin(boundary)) return false;
+                }
+            }
+            if (job.faultBody) return job.xml.feed(data, len);
+            return job.parser.feed(data, len, [this](const uint8_t* image, size_t n) {
+                if (maxImageSize && job.parser.imageBytes() > maxImageSize) {
+                    Serial.println("Image exceeds maximum size");
+                    return false;
+                }
+                return deliver(image, n);
+            });
+        }, budgetMs);
+        if (result == HTTP_RESULT_PENDING) return false;
+        if (result != HTTP_RESULT_OK) return soapFailed(result, JOB_RETRIEVE);
+        finishSoap(job.call, result);
+        if (job.faultBody) {
+            // The device dropped the prepared job after all: create one the usual way
+            if (job.ticketUsed) {
+                Serial.println("Prepared scan job expired: " + job.fault);
+                job.ticketUsed = false;
+                job.call.attempt = 0;
+                job.step = JOB_CREATE;
+                return true;
+            }
+            // An empty feeder ends a batch
+            if (job.batch && batchStats.pages > 0 && job.fault.indexOf("NoImagesAvailable") != -1) {
+                finishBatch();
+                job.step = JOB_DONE;
+                return true;
+            }
+            Serial.println("RetrieveImage failed: " + job.fault);
+            return failJob(nullptr);
         }
+        if (!job.parserStarted || !job.parser.imageComplete() || job.parser.imageBytes() == 0) return failJob("RetrieveImage failed");
+        return imageReceived();
+    }
 
-        filePtr.write(imageBuffer, imageSize);
-        filePtr.close();
+    case JOB_ESCL_CREATE: {
+        // Feeder origins map to eSCL's Feeder source; ADFDuplex also asks for duplex
+        MFPSoapSlots slots;
+        slots.set(SOAP_ORIGIN, job.origin.startsWith("ADF") || job.origin == "Feeder" ? "Feeder" : "Platen");
+        slots.set(SOAP_DUPLEX, job.origin == "ADFDuplex" ? "true" : "false");
+        slots.set(SOAP_FORMAT, esclFormat(job.format));
+        slots.set(SOAP_WIDTH, (long)job.width);
+        slots.set(SOAP_HEIGHT, (long)job.height);
+
+        HttpResult result = startRequest(job.call, job.host, job.port, "POST", "/eSCL/ScanJobs", "text/xml", &MFPEsclScanSettings, slots);
+        if (result != HTTP_RESULT_PENDING) return soapFailed(result, JOB_ESCL_CREATE);
+        job.step = JOB_ESCL_CREATE_READ;
+        return true;
+    }
 
-        Serial.println("Image saved to filesystem");
+    case JOB_ESCL_CREATE_READ: {
+        // 201 Created with the job URL in Location; any body is ignored
+        HttpResult result = pumpSoap(job.call, [](const uint8_t*, size_t) {
+            return true;
+        }, budgetMs);
+        if (result == HTTP_RESULT_PENDING) return false;
+        if (result != HTTP_RESULT_OK) return soapFailed(result, JOB_ESCL_CREATE);
+        finishSoap(job.call, result);
+        int status = job.call.response.status();
+        const char* location = job.call.response.location();
+        // Location may be absolute; only the path is kept
+        const char* path = strstr(location, "://");
+        path = path ? strchr(path + 3, '/') : location;
+        if (status / 100 != 2 || !path || *path != '/') {
+            Serial.println("eSCL ScanJobs failed: " + String(status));
+            return failJob(nullptr);
+        }
+        job.esclJob = path;
+        job.id = path;
+        if (!job.id.endsWith("/")) job.id += '/';
+        job.id += "NextDocument";
+
+        job.call.attempt = 0;
+        job.busyRetries = 0;
+        job.retryAt = millis();
+        job.step = JOB_ESCL_NEXT;
+        return true;
     }
 
-    return imageBuffer;
-}
+    case JOB_ESCL_NEXT: {
+        if ((long)(millis() - job.retryAt) < 0) return false;
+        MFPSoapSlots slots;
+        expectedImageSize = 0;
+        job.parserStarted = false;
+        job.stagesStarted = false;
+        job.bodyBytes = 0;
+        if (job.busyRetries == 0) job.pageStart = millis();
+        HttpResult result = startRequest(job.call, job.host, job.port, "GET", job.id.c_str(), nullptr, nullptr, slots);
+        if (result != HTTP_RESULT_PENDING) return soapFailed(result, JOB_ESCL_NEXT);
+        // As with WSD, the previous page is handed off while the device scans
+        if (job.pageReady) job.step = job.buffered ? JOB_SAVE : JOB_PAGE_DONE;
+        else job.step = JOB_ESCL_NEXT_READ;
+        return true;
+    }
 
+    case JOB_ESCL_NEXT_READ: {
+        // The body is the document itself: no envelope, no multipart
+        HttpResult result = pumpSoap(job.call, [this](const uint8_t* data, size_t len) {
+            if (job.call.response.status() != 200) return true;
+            if (!job.parserStarted) {
+                job.parserStarted = true;
+                if (!imageAnnounced(job.call.response.contentLength())) return false;
+            }
+            job.bodyBytes += len;
+            if (maxImageSize && job.bodyBytes > maxImageSize) {
+                Serial.println("Image exceeds maximum size");
+                return false;
+            }
+            return deliver(data, len);
+        }, budgetMs);
+        if (result == HTTP_RESULT_PENDING) return false;
+        if (result != HTTP_RESULT_OK) return soapFailed(result, JOB_ESCL_NEXT);
+        finishSoap(job.call, result);
+        int status = job.call.response.status();
+        if (status == 503 && ++job.busyRetries <= 60) {
+            // Still scanning or warming up; ask again shortly
+            job.retryAt = millis() + 500;
+            job.call.attempt = 0;
+            job.step = JOB_ESCL_NEXT;
+            return true;
+        }
+        // No more documents ends a batch
+        if (status == 404 && job.batch && batchStats.pages > 0) {
+            finishBatch();
+            job.afterDelete = JOB_DONE;
+            job.call.attempt = 0;
+            job.step = JOB_ESCL_DELETE;
+            return true;
+        }
+        if (status != 200 || job.bodyBytes == 0) {
+            Serial.println("eSCL NextDocument failed: " + String(status));
+            return failJob(nullptr);
+        }
+        job.busyRetries = 0;
+        return imageReceived();
+    }
 
-String ArduinoMFP::look(int mode) {
-    if (mode != 0 && mode != 1) return "{}";  // reject any number not 0 or 1
+    case JOB_ESCL_DELETE: {
+        // Many devices keep a finished job, and refuse new ones, until it is deleted
+        MFPSoapSlots slots;
+        HttpResult result = startRequest(job.call, job.host, job.port, "DELETE", job.esclJob.c_str(), nullptr, nullptr, slots);
+        if (result != HTTP_RESULT_PENDING) {
+            if (finishSoap(job.call, result)) return true;
+            job.esclJob = "";
+            job.step = job.afterDelete;
+            return true;
+        }
+        job.step = JOB_ESCL_DELETE_READ;
+        return true;
+    }
 
-    String json = "{";
-    bool first = true;
+    case JOB_ESCL_DELETE_READ: {
+        HttpResult result = pumpSoap(job.call, [](const uint8_t*, size_t) {
+            return true;
+        }, budgetMs);
+        if (result == HTTP_RESULT_PENDING) return false;
+        if (finishSoap(job.call, result)) {
+            job.step = JOB_ESCL_DELETE;
+            return true;
+        }
+        // The image is in either way; a device that already dropped the job answers 404
+        job.esclJob = "";
+        job.step = job.afterDelete;
+        return true;
+    }
 
-    if (mode == 0) {  // Printers
-        int n = MDNS.queryService("ipp", "tcp");
-        if (n > 0) {
-            json += "\"printers\":[";
-            for (int i = 0; i < n; i++) {
-                if (i > 0) json += ",";
-                json += "{\"host\":\"" + MDNS.hostname(i) + "\",\"ip\":\"" +
-                        MDNS.address(i).toString() + "\",\"port\":" + MDNS.port(i) + "}";
+    case JOB_SAVE: {
+        if (!job.file) {
+            char path[64] = "/scan.jpg";
+            if (job.batch) snprintf(path, sizeof(path), job.pathTemplate.c_str(), job.page.page);
+            job.file = job.filesystem == 0 ? SPIFFS.open(path, FILE_WRITE) : LittleFS.open(path, FILE_WRITE);
+            if (!job.file) return failJob("Failed to open file for writing");
+        }
+        // Written a block at a time so one poll never stalls on a large image
+        size_t n = imageSize - job.saved;
+        if (n > 4 * MFP_BLOCK_SIZE) n = 4 * MFP_BLOCK_SIZE;
+        MFP_STATS(uint32_t writeStart = micros());
+        if (job.file.write(imageBuffer + job.saved, n) != n) return failJob("Failed to write image");
+        MFP_STATS(stats.saveMicros += micros() - writeStart);
+        job.saved += n;
+        if (job.saved == imageSize) {
+            job.file.close();
+            MFP_STATS(statsPhase(MFP_PHASE_SAVED));
+            if (job.batch) {
+                pageDone();
+                return true;
+            }
+            Serial.println("Image saved to filesystem");
+            job.step = JOB_DONE;
+        }
+        return true;
+    }
+
+    case JOB_PAGE_DONE:
+        pageDone();
+        return true;
+
+    case JOB_PRINT_CONNECT:
+        job.printStart = millis();
+        MFP_STATS(exchangeStart = micros(); stats.exchanges++);
+        if (!job.printClient.connect(job.host.c_str(), (uint16_t)job.port, connectTimeout)) return failJob(nullptr);
+        MFP_STATS(statsPhase(MFP_PHASE_CONNECTED));
+        job.lastWrite = millis();
+        job.step = JOB_PRINT_SEND;
+        return true;
+
+    case JOB_PRINT_SEND: {
+        if (job.blockSent == job.blockLen) {
+            job.blockLen = job.source(job.block, MFP_BLOCK_SIZE);
+            job.blockSent = 0;
+            job.lastWrite = millis();  // time spent in the source does not count
+            if (job.blockLen == 0) {
+                // All data is with the TCP stack; stop() still delivers what is queued
+                printStats.bytes = job.sent;
+                printStats.millis = millis() - job.printStart;
+                printStats.kbPerSec = printStats.millis ? job.sent / (float)printStats.millis : 0;
+                MFP_STATS(statsPhase(MFP_PHASE_SENT));
+                job.replyStart = millis();
+                if (job.collectReply) {
+                    job.step = JOB_PRINT_READ;
+                } else {
+                    endPrint();
+                    job.step = JOB_DONE;
+                }
+                return true;
             }
-            json += "]";
         }
+        // A short write means the socket buffer is full; the rest of the block waits
+        size_t written = job.printClient.write(job.block + job.blockSent, job.blockLen - job.blockSent);
+        if (written == 0) {
+            if (!job.printClient.connected()) return failJob("Printer closed the connection");
+            // A printer that keeps the connection open but stops reading
+            if (millis() - job.lastWrite > responseTimeout) return failJob("Timeout sending to printer");
+            return false;
+        }
+        job.lastWrite = millis();
+        job.blockSent += written;
+        job.sent += written;
+        MFP_STATS(statsHeap());
+        return true;
     }
 
-    if (mode == 1) {  // Scanners
-        const char* services[] = {"uscanner", "scanner", "airscan", "escl"};
-        json += "\"scanners\":[";
-        bool any = false;
-        for (const char* service : services) {
-            int n = MDNS.queryService(service, "tcp");
-            for (int j = 0; j < n; j++) {
-                if (any) json += ",";
-                json += "{\"host\":\"" + MDNS.hostname(j) + "\",\"ip\":\"" +
-                        MDNS.address(j).toString() + "\",\"port\":" + MDNS.port(j) + "}";
-                any = true;
+    case JOB_PRINT_READ: {
+        // Collect whatever the printer answers until it hangs up or 10 s pass
+        int avail = job.printClient.available();
+        if (avail > 0) {
+            int n = job.printClient.read(ioBuffer, avail < (int)sizeof(ioBuffer) ? avail : sizeof(ioBuffer));
+            if (n > 0) job.output.concat((const char*)ioBuffer, n);
+            return true;
+        }
+        if (job.printClient.connected() && millis() - job.replyStart < 10000) return false;
+        endPrint();
+        job.step = JOB_DONE;
+        return true;
+    }
+
+    case JOB_IPP_CONNECT: {
+        // The operation attributes are encoded in the print block, which is free until the document starts
+        job.printStart = millis();
+        MFPIppWriter request(job.block, MFP_BLOCK_SIZE);
+        request.begin(MFP_IPP_PRINT_JOB, ++ippRequestId);
+        request.printerUri(job.host.c_str(), job.port, job.ippPath.c_str());
+        request.text(MFP_IPP_TAG_NAME, "requesting-user-name", "ArduinoMFP");
+        request.text(MFP_IPP_TAG_NAME, "job-name", "ArduinoMFP");
+        request.text(MFP_IPP_TAG_MIME_TYPE, "document-format", job.ippFormat.c_str());
+        request.end();
+        if (request.failed()) return failJob("IPP request too large");
+
+        HttpResult result = startIpp(job.call, job.host, job.port, job.ippPath.c_str(), request, true);
+        if (result != HTTP_RESULT_PENDING) {
+            // Nothing of the document is lost yet, so a dead pooled socket can still be replaced
+            if (finishSoap(job.call, result)) return true;
+            return failJob(result == HTTP_RESULT_CONNECT_FAILED ? "Connection to printer failed" : "IPP Print-Job failed");
+        }
+        // From here on the document is consumed and cannot be sent again
+        job.call.attempt = 2;
+        job.ippResponse.begin();
+        job.lastChunk = false;
+        job.step = JOB_IPP_SEND;
+        return true;
+    }
+
+    case JOB_IPP_SEND: {
+        WiFiClient* client = job.call.client;
+        // A printer that answers early (e.g. unsupported format) does not get the rest
+        if (client->available() > 0) {
+            job.call.lastData = millis();
+            job.step = JOB_IPP_READ;
+            return true;
+        }
+        if (job.blockSent == job.blockLen) {
+            if (job.blockLen > 8) job.sent += job.blockLen - 8;
+            if (job.lastChunk) {
+                printStats.bytes = job.sent;
+                printStats.millis = millis() - job.printStart;
+                printStats.kbPerSec = printStats.millis ? job.sent / (float)printStats.millis : 0;
+                MFP_STATS(statsCall(job.call, MFP_PHASE_SENT));
+                job.call.lastData = millis();
+                job.step = JOB_IPP_READ;
+                return true;
             }
+            // Each block is one chunk: a fixed-width size line in front, CRLF behind
+            static_assert(MFP_BLOCK_SIZE - 8 <= 0xFFFF, "chunk size line has room for four hex digits only");
+            size_t n = job.source(job.block + 6, MFP_BLOCK_SIZE - 8);
+            if (n == 0) {
+                memcpy(job.block, "0\r\n\r\n", 5);
+                job.blockLen = 5;
+                job.lastChunk = true;
+            } else {
+                char size[8];
+                snprintf(size, sizeof(size), "%04x\r\n", (unsigned)n);
+                memcpy(job.block, size, 6);
+                job.block[6 + n] = '\r';
+                job.block[7 + n] = '\n';
+                job.blockLen = n + 8;
+            }
+            job.blockSent = 0;
+        }
+        size_t written = client->write(job.block + job.blockSent, job.blockLen - job.blockSent);
+        if (written == 0) {
+            if (!client->connected()) return failJob("Printer closed the connection");
+            // A printer that stops reading but keeps the connection open
+            if (millis() - job.call.lastData > responseTimeout) return failJob("Timeout sending to printer");
+            return false;
         }
-        json += "]";
+        job.call.lastData = millis();
+        job.blockSent += written;
+        MFP_STATS(statsHeap());
+        return true;
     }
 
-    json += "}";
+    case JOB_IPP_READ: {
+        HttpResult result = pumpSoap(job.call, [this](const uint8_t* data, size_t len) {
+            return job.ippResponse.feed(data, len);
+        }, budgetMs);
+        if (result == HTTP_RESULT_PENDING) return false;
+        // After an early answer the chunked body is unfinished; the socket cannot carry another request
+        if (!job.lastChunk) {
+            connections.release(job.call.client, false);
+            job.call.client = nullptr;
+        }
+        finishSoap(job.call, result);
+        if (result == HTTP_RESULT_TIMEOUT) return failJob("Timeout waiting for printer");
+        const MFPIppResponse& response = job.ippResponse;
+        if (result != HTTP_RESULT_OK || job.call.response.status() != 200 || !response.ok() || response.jobId() <= 0) {
+            String reason = response.statusMessage();
+            if (reason == "") reason = "status " + String(job.call.response.status()) + ", IPP 0x" + String((unsigned int)response.status(), HEX);
+            Serial.println("IPP Print-Job failed: " + reason);
+            return failJob(nullptr);
+        }
+        job.ippJobId = response.jobId();
+        endPrint();
+        job.step = JOB_DONE;
+        return true;
+    }
+
+    default:
+        return false;
+    }
+}
+
+void ArduinoMFP::endPrint() {
+    job.printClient.stop();
+    job.payload = String();
+    if (job.block) {
+        pool->release(job.block);
+        job.block = nullptr;
+    }
+}
+
+// A complete image (or page) is in; hand it off or request the next page
+bool ArduinoMFP::imageReceived() {
+    job.saved = 0;
+    if (job.stagesStarted) {
+        MFP_STATS(uint32_t stageStart = micros());
+        for (int i = 0; i < stageCount; i++) stages[i]->end();
+        MFP_STATS(stats.stageMicros += micros() - stageStart);
+    }
+    if (job.batch) {
+        uint32_t ms = millis() - job.pageStart;
+        job.page.page = batchStats.pages + 1;
+        job.page.bytes = jobImageBytes();
+        job.page.millis = ms;
+        job.page.kbPerSec = ms ? job.page.bytes / (float)ms : 0;
+        batchStats.pages++;
+        batchStats.bytes += job.page.bytes;
+        job.pageReady = true;
+        job.call.attempt = 0;
+        job.step = job.escl ? JOB_ESCL_NEXT : JOB_RETRIEVE;
+        return true;
+    }
+    if (job.direct) {
+        // Only the last buffer is still on its way to flash
+        MFP_STATS(uint32_t flushStart = micros());
+        if (!job.writer.finish()) return failJob("Failed to write image");
+        MFP_STATS(stats.saveMicros += micros() - flushStart + job.writer.getStallMillis() * 1000);
+        MFP_STATS(statsPhase(MFP_PHASE_SAVED));
+        Serial.println("Image saved to " + job.path);
+    }
+    job.step = job.buffered && (job.filesystem == 0 || job.filesystem == 1) ? JOB_SAVE : JOB_DONE;
+    if (job.escl) {
+        job.afterDelete = job.step;
+        job.call.attempt = 0;
+        job.step = JOB_ESCL_DELETE;
+    }
+    return true;
+}
+
+void ArduinoMFP::pageDone() {
+    job.pageReady = false;
+    if (job.buffered) imageSize = 0;  // the buffer is kept for the next page
+    // Handing off may take a while; the device has been working meanwhile
+    job.call.lastData = millis();
+    job.step = job.escl ? JOB_ESCL_NEXT_READ : JOB_RETRIEVE_READ;
+    finishBatch();
+    if (pageHandler) pageHandler(job.page);
+    if (job.failAfterPage) failJob(job.failAfterPage);
+}
+
+void ArduinoMFP::finishBatch() {
+    batchStats.millis = millis() - job.batchStart;
+    batchStats.kbPerSec = batchStats.millis ? batchStats.bytes / (float)batchStats.millis : 0;
+}
+
+bool ArduinoMFP::soapFailed(HttpResult result, JobStep retryStep) {
+    if (finishSoap(job.call, result)) {
+        job.step = retryStep;
+        return true;
+    }
+    const char* message;
+    if (result == HTTP_RESULT_CONNECT_FAILED) message = "Connection to scanner failed";
+    else if (result == HTTP_RESULT_TIMEOUT) message = "Timeout waiting for scanner";
+    else if (retryStep == JOB_CREATE) message = "CreateScanJob failed";
+    else if (retryStep == JOB_ESCL_CREATE) message = "eSCL ScanJobs failed";
+    else if (retryStep == JOB_ESCL_NEXT) message = "eSCL NextDocument failed";
+    else message = "RetrieveImage failed";
+    // The page received before the failed request is complete; it is saved
+    // or handed off first, and the job fails after that
+    if (job.pageReady) {
+        job.failAfterPage = message;
+        job.step = job.buffered ? JOB_SAVE : JOB_PAGE_DONE;
+        return true;
+    }
+    return failJob(message);
+}
+
+
+String ArduinoMFP::look(int mode, bool refresh) {
+    if (mode != 0 && mode != 1) return "{}";  // reject any number not 0 or 1
+
+    uint8_t services = lookServices(mode, refresh);
+    String json;
+    MFPStringPrint out(json);
+    if (mode == 0) {  // Printers
+        // An empty printer list has always been reported as {}
+        MFPDevice first;
+        if (discovery.getDevices(&first, 1, services) == 0) return "{}";
+        MFPJson::devices(out, "printers", discovery, services);
+    } else {  // Scanners
+        MFPJson::devices(out, "scanners", discovery, services);
+    }
     return json;
 }
 
-String ArduinoMFP::print(const char* ip, int port, String payload) {
-    WiFiClient client;
+size_t ArduinoMFP::look(int mode, MFPDevice* devices, size_t max, bool refresh) {
+    if (mode != 0 && mode != 1) return 0;
+    return discovery.getDevices(devices, max, lookServices(mode, refresh));
+}
+
+uint8_t ArduinoMFP::lookServices(int mode, bool refresh) {
+    uint8_t services = mode == 0 ? MFP_SERVICE_PRINTERS : MFP_SERVICE_SCANNERS;
+    // Served from the cache; mDNS is only asked for types whose records lapsed
+    if (refresh) discovery.refresh(services);
+    else if (!discovery.background()) discovery.refreshStale(services);
+    return services;
+}
+
+MFPDiscovery& ArduinoMFP::getDiscovery() {
+    return discovery;
+}
+
+String ArduinoMFP::print(const char* ip, int port, const String& payload) {
     String response = "";
 
-    if (!client.connect(ip, (uint16_t)port)) {
+    // Sent straight from the caller's string, no copy
+    size_t offset = 0;
+    bool started = beginPrint(ip, port, [&payload, &offset](uint8_t* buffer, size_t size) {
+        return readText(payload, offset, buffer, size);
+    }, payload.length() + 2, true);
+    if (!started || finishJob() != MFP_JOB_DONE) {
         response = "Connection failed! Check if " + String(ip) + ":" + String(port) + " is actually real, open and not being used.";
         return response;
     }
 
-    String message = payload + "\n\f";
-    client.print(message);
-
-    unsigned long start = millis();
-    while (client.connected() && millis() - start < 10000) {
-        while (client.available()) {
-            int val = client.read();
-            if (val == -1) break; // no data
-            char c = (char)val;
-            response += c;  // append char to response
-        }
-    }
-    client.stop();
-
+    response = job.output;
     if (response == "") {
         response = "Successful, but sorry no output received.";
     } else {
@@ -417,133 +1854,237 @@ String ArduinoMFP::print(const char* ip, int port, String payload) {
     return response;
 }
 
+bool ArduinoMFP::print(const char* url, int port, Stream& data) {
+    if (!beginPrint(url, port, data)) return false;
+    return finishJob() == MFP_JOB_DONE;
+}
+
+bool ArduinoMFP::print(const char* url, int port, PrintSource source) {
+    if (!beginPrint(url, port, source)) return false;
+    return finishJob() == MFP_JOB_DONE;
+}
+
 
 String ArduinoMFP::supported(const char* url, int port) {
-  WiFiClient client;
-  String endpoint = "/WebServices/Device";
-  String host = String(url);
-  String uuid = "uuid:12345678-1234-1234-1234-123456789abc";
-
-  String soapBody =
-    "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
-    "<soap:Envelope xmlns:soap=\"http://www.w3.org/2003/05/soap-envelope\""
-    " xmlns:wsa=\"http://schemas.xmlsoap.org/ws/2004/08/addressing\""
-    " xmlns:wxf=\"http://schemas.xmlsoap.org/ws/2004/09/transfer\""
-    " xmlns:wsd=\"http://schemas.xmlsoap.org/ws/2005/04/discovery\">"
-    "<soap:Header>"
-    "<wsa:To>http://" + host + ":" + String(port) + endpoint + "</wsa:To>"
-    "<wsa:Action>http://schemas.xmlsoap.org/ws/2004/09/transfer/Get</wsa:Action>"
-    "<wsa:MessageID>" + uuid + "</wsa:MessageID>"
-    "</soap:Header>"
-    "<soap:Body />"
-    "</soap:Envelope>";
-
-  String request =
-    "POST " + endpoint + " HTTP/1.1\r\n" +
-    "Host: " + host + ":" + String(port) + "\r\n" +
-    "Content-Type: application/soap+xml\r\n" +
-    "Content-Length: " + String(soapBody.length()) + "\r\n" +
-    "Connection: close\r\n\r\n" +
-    soapBody;
-
-  if (!client.connect(url, port)) {
+  MFPDeviceInfo info;
+  HttpResult result = queryMetadata(url, port, info);
+
+  if (result == HTTP_RESULT_CONNECT_FAILED) {
     return "{\"error\": \"connection failed\"}";
   }
+  if (result == HTTP_RESULT_TIMEOUT) {
+    return "{\"error\": \"timeout waiting for response\"}";
+  }
+
+  // --- Return JSON summary ---
+  String json;
+  MFPStringPrint out(json);
+  MFPJson::deviceInfo(out, info);
+  return json;
+}
 
-  client.print(request);
+bool ArduinoMFP::supported(const char* url, int port, MFPDeviceInfo& info) {
+  return queryMetadata(url, port, info) == HTTP_RESULT_OK;
+}
 
-  unsigned long timeout = millis();
-  while (client.connected() && !client.available()) {
-    if (millis() - timeout > 5000) {
-      client.stop();
-      return "{\"error\": \"timeout waiting for response\"}";
+ArduinoMFP::HttpResult ArduinoMFP::queryMetadata(const char* url, int port, MFPDeviceInfo& info) {
+  String host = String(url);
+  char messageID[37];
+  generateUUID(messageID);
+
+  MFPSoapSlots slots;
+  slots.set(SOAP_HOST, url);
+  slots.set(SOAP_PORT, (long)port);
+  slots.set(SOAP_MESSAGE_ID, messageID, 36);
+
+  // --- Collect fields in one pass over the response ---
+  memset(&info, 0, sizeof(info));
+  char hostedAddress[sizeof(info.services.printer)] = "";
+  bool hostedPrinter = false;
+  bool hostedScanner = false;
+
+  MFPXmlParser xml;
+  int uuidTag = xml.watch("Host/Address");
+  int modelNameTag = xml.watch("ModelName");
+  int modelUrlTag = xml.watch("ModelUrl");
+  int hostedTag = xml.watch("Hosted");
+  int addressTag = xml.watch("Hosted/Address");
+  int typesTag = xml.watch("Hosted/Types");
+  int serviceIdTag = xml.watch("Hosted/ServiceId");
+  xml.onValue([&](int id, const char* text, size_t len) {
+    if (id == uuidTag) {
+      if (!info.uuid[0]) strlcpy(info.uuid, text, sizeof(info.uuid));
+    } else if (id == modelNameTag) {
+      if (!info.modelName[0]) strlcpy(info.modelName, text, sizeof(info.modelName));
+    } else if (id == modelUrlTag) {
+      if (!info.modelUrl[0]) strlcpy(info.modelUrl, text, sizeof(info.modelUrl));
+    } else if (id == addressTag) {
+      if (!hostedAddress[0]) strlcpy(hostedAddress, text, sizeof(hostedAddress));
+      if (strstr(text, "PrinterService")) hostedPrinter = true;
+      if (strstr(text, "ScannerService")) hostedScanner = true;
+    } else if (id == typesTag || id == serviceIdTag) {
+      if (strstr(text, "PrinterService")) hostedPrinter = true;
+      if (strstr(text, "ScannerService")) hostedScanner = true;
+    } else if (id == hostedTag) {
+      // End of one Hosted block
+      if (hostedPrinter) strlcpy(info.services.printer, hostedAddress, sizeof(info.services.printer));
+      if (hostedScanner) strlcpy(info.services.scanner, hostedAddress, sizeof(info.services.scanner));
+      hostedAddress[0] = 0;
+      hostedPrinter = false;
+      hostedScanner = false;
     }
-    delay(10);
-  }
+  });
 
-  String response;
-  while (client.available()) {
-    response += client.readString();
+  return sendSoapRequest(host, port, MFPGetMetadataSoap, slots, xml, "/WebServices/Device");
+}
+
+bool ArduinoMFP::getCapabilities(const char* url, int port, MFPCapabilities& caps, bool refresh) {
+  if (!refresh && capabilities.get(url, caps)) {
+    capabilities.countHit();
+    return true;
   }
-  client.stop();
-
-  // --- Improved Extract Helper (handles xml:lang, namespaces, etc.) ---
-  auto extractAnyTag = [](const String& xml, const char* const tags[], int tagCount) {
-    for (int i = 0; i < tagCount; i++) {
-      String tag = String(tags[i]);
-      String base = tag;
-      int colon = tag.indexOf(':');
-      if (colon != -1) base = tag.substring(colon + 1);  // e.g. wsdp:ModelName → ModelName
-
-      // Try full tag form (<wsdp:ModelName ...>value</wsdp:ModelName>)
-      int open = xml.indexOf("<" + tag);
-      if (open != -1) {
-        open = xml.indexOf(">", open);
-        if (open != -1) {
-          open++;
-          int close = xml.indexOf("</" + base + ">", open);
-          if (close == -1)
-            close = xml.indexOf("</" + tag + ">", open);
-          if (close != -1) {
-            String result = xml.substring(open, close);
-            result.trim();
-            return result;
-          }
-        }
-      }
+  capabilities.countMiss();
+
+  memset(&caps, 0, sizeof(caps));
+  strlcpy(caps.host, url, sizeof(caps.host));
+  caps.port = port;
+  if (queryMetadata(url, port, caps.info) != HTTP_RESULT_OK) return false;
+
+  if (caps.info.services.scanner[0]) {
+    String host;
+    int servicePort;
+    String path;
+    scannerService(caps.info.services.scanner, url, port, host, servicePort, path);
+    caps.hasScanner = queryScannerElements(host.c_str(), servicePort, path.c_str(), caps.scanner) == HTTP_RESULT_OK;
+  }
+  capabilities.store(caps);
+  // With the metadata version the cache keeps for the device
+  capabilities.get(url, caps);
+  return true;
+}
 
-      // Try namespace-free form (<ModelName ...>value</ModelName>)
-      open = xml.indexOf("<" + base);
-      if (open != -1) {
-        open = xml.indexOf(">", open);
-        if (open != -1) {
-          open++;
-          int close = xml.indexOf("</" + base + ">", open);
-          if (close != -1) {
-            String result = xml.substring(open, close);
-            result.trim();
-            return result;
-          }
-        }
-      }
+MFPCapabilityCache& ArduinoMFP::getCapabilityCache() {
+  return capabilities;
+}
+
+ArduinoMFP::HttpResult ArduinoMFP::queryScannerElements(const char* url, int port, const char* path, MFPScannerCaps& scanner) {
+  char messageID[37];
+  generateUUID(messageID);
+
+  MFPSoapSlots slots;
+  slots.set(SOAP_HOST, url);
+  slots.set(SOAP_MESSAGE_ID, messageID, 36);
+
+  memset(&scanner, 0, sizeof(scanner));
+  MFPXmlParser xml;
+  int formatTag = xml.watch("FormatsSupported/FormatValue");
+  int platenTag = xml.watch("ScannerConfiguration/Platen");
+  int adfTag = xml.watch("ScannerConfiguration/ADF");
+  int duplexTag = xml.watch("ADF/ADFSupportsDuplex");
+  int platenWidthTag = xml.watch("PlatenResolutions/Widths/Width");
+  int platenHeightTag = xml.watch("PlatenResolutions/Heights/Height");
+  int adfWidthTag = xml.watch("ADFResolutions/Widths/Width");
+  int adfHeightTag = xml.watch("ADFResolutions/Heights/Height");
+
+  // Platen and ADF list their resolutions separately; keep the union
+  auto addResolution = [](uint16_t* values, uint8_t& count, const char* text) {
+    int value = atoi(text);
+    if (value <= 0) return;
+    for (uint8_t i = 0; i < count; i++) {
+      if (values[i] == value) return;
     }
-    return String("");
+    if (count < MFPScannerCaps::maxResolutions) values[count++] = value;
   };
 
-  // --- Extract fields ---
-  const char* modelTags[] = {"wsdp:ModelName", "pnpx:ModelName", "df:ModelName", "ModelName"};
-  const char* modelUrlTags[] = {"wsdp:ModelUrl", "pnpx:ModelUrl", "df:ModelUrl", "ModelUrl"};
-
-  String modelName = extractAnyTag(response, modelTags, 4);
-  String modelUrl  = extractAnyTag(response, modelUrlTags, 4);
-
-  // --- Find printer/scanner URLs ---
-  String printerUrl = "";
-  String scannerUrl = "";
-  int pos = 0;
-  while ((pos = response.indexOf("<wsdp:Hosted>", pos)) != -1 ||
-         (pos = response.indexOf("<Hosted>", pos)) != -1) {
-    int end = response.indexOf("</wsdp:Hosted>", pos);
-    if (end == -1) end = response.indexOf("</Hosted>", pos);
-    if (end == -1) break;
-    String block = response.substring(pos, end);
-
-    const char* addrTags[] = {"wsa:Address", "Address"};
-    if (block.indexOf("PrinterService") != -1)
-      printerUrl = extractAnyTag(block, addrTags, 2);
-    if (block.indexOf("ScannerService") != -1)
-      scannerUrl = extractAnyTag(block, addrTags, 2);
-
-    pos = end + 1;
-  }
+  xml.onValue([&](int id, const char* text, size_t len) {
+    if (id == formatTag) {
+      if (len > 0 && scanner.formatCount < MFPScannerCaps::maxFormats) {
+        strlcpy(scanner.formats[scanner.formatCount++], text, sizeof(scanner.formats[0]));
+      }
+    } else if (id == platenTag) {
+      scanner.sources |= MFP_SOURCE_PLATEN;
+    } else if (id == adfTag) {
+      scanner.sources |= MFP_SOURCE_ADF;
+    } else if (id == duplexTag) {
+      if (strcmp(text, "true") == 0 || strcmp(text, "1") == 0) scanner.sources |= MFP_SOURCE_ADF_DUPLEX;
+    } else if (id == platenWidthTag || id == adfWidthTag) {
+      addResolution(scanner.widths, scanner.widthCount, text);
+    } else if (id == platenHeightTag || id == adfHeightTag) {
+      addResolution(scanner.heights, scanner.heightCount, text);
+    }
+  });
 
-  // --- Return JSON summary ---
-  String json = "{";
-  json += "\"modelName\": \"" + modelName + "\", ";
-  json += "\"modelUrl\": \"" + modelUrl + "\", ";
-  json += "\"printerService\": \"" + printerUrl + "\", ";
-  json += "\"scannerService\": \"" + scannerUrl + "\"";
-  json += "}";
+  return sendSoapRequest(String(url), port, MFPGetScannerElementsSoap, slots, xml, path);
+}
 
-  return json;
+const MFPStats& ArduinoMFP::getStats() const {
+    return stats;
+}
+
+void ArduinoMFP::onStats(MFPStatsHook hook) {
+    statsHook = hook;
+}
+
+#if ARDUINOMFP_STATS
+
+void ArduinoMFP::statsBegin(bool printing) {
+    stats = MFPStats();
+    stats.printing = printing;
+    statsOpen = true;
+    heapBase = ESP.getFreeHeap();
+    for (int i = 0; i < MFP_PHASE_COUNT; i++) statsMarks[i] = 0;
+    statsPhase(MFP_PHASE_START);
+}
+
+void ArduinoMFP::statsPhase(MFPPhase phase) {
+    if (!statsOpen) return;
+    uint32_t now = micros();
+    // Each phase is timed from the one that normally precedes it
+    switch (phase) {
+    case MFP_PHASE_START:
+        statsMarks[MFP_PHASE_START] = now;
+        break;
+    case MFP_PHASE_CONNECTED:
+        stats.connectMicros += now - exchangeStart;
+        break;
+    case MFP_PHASE_SENT:
+        stats.sendMicros += now - statsMarks[MFP_PHASE_CONNECTED];
+        break;
+    case MFP_PHASE_FIRST_BYTE:
+        stats.waitMicros += now - statsMarks[MFP_PHASE_SENT];
+        break;
+    case MFP_PHASE_HEADERS:
+        stats.headerMicros += now - statsMarks[MFP_PHASE_FIRST_BYTE];
+        break;
+    case MFP_PHASE_BODY:
+        stats.transferMicros += now - statsMarks[MFP_PHASE_HEADERS];
+        break;
+    default:
+        break;
+    }
+    statsMarks[phase] = now;
+    stats.phaseMicros[phase] = now - statsMarks[MFP_PHASE_START];
+    if (statsHook) statsHook(phase, stats);
+}
+
+void ArduinoMFP::statsCall(const SoapCall& call, MFPPhase phase) {
+    if (&call == &job.call) statsPhase(phase);
+}
+
+void ArduinoMFP::statsHeap() {
+    uint32_t free = ESP.getFreeHeap();
+    if (statsOpen && free < heapBase && heapBase - free > stats.peakHeap) stats.peakHeap = heapBase - free;
+}
+
+void ArduinoMFP::statsEnd() {
+    if (!statsOpen) return;
+    stats.ok = job.step == JOB_DONE;
+    if (job.printing) stats.bytes = job.sent;
+    else if (job.batch) stats.bytes = batchStats.bytes;
+    else stats.bytes = jobImageBytes();
+    stats.totalMicros = micros() - statsMarks[MFP_PHASE_START];
+    stats.bytesPerSec = stats.totalMicros ? stats.bytes * 1e6f / stats.totalMicros : 0;
+    statsPhase(MFP_PHASE_DONE);
+    statsOpen = false;
 }
+#endif
@@ -3,33 +3,519 @@
 
 #include <Arduino.h>
 #include <WiFi.h>
+#include <FS.h>
+#include "MFPMultipart.h"
+#include "MFPBufferPool.h"
+#include "MFPHttp.h"
+#include "MFPSoap.h"
+#include "MFPXml.h"
+#include "MFPDiscovery.h"
+#include "MFPCapabilities.h"
+#include "MFPFileWriter.h"
+#include "MFPIpp.h"
+#include "MFPJson.h"
+#include "MFPStages.h"
 
+#ifndef MFP_MAX_STAGES
+#define MFP_MAX_STAGES 4
+#endif
+
+// Build settings that size arrays inside the classes. A sketch has to see the
+// same values as the library; otherwise the constructor refers to an instance
+// the library does not define, and linking fails with an undefined reference to
+// MFPLayout<...>::check() instead of the two sides disagreeing on the layout.
+// Set them for the whole build (build_flags), not with #define in the sketch.
+template <int... Values>
+struct MFPLayout {
+    static MFPLayout check();  // defined by the library for the values it was built with
+};
+typedef MFPLayout<MFP_BLOCK_SIZE, MFP_MAX_STAGES, MFP_MAX_DEVICES, MFP_MAX_CACHED_DEVICES, MFP_POOL_SLOTS> MFPBuildLayout;
+
+// State of a job started with beginScan() or beginPrint()
+enum MFPJobState { MFP_JOB_IDLE, MFP_JOB_RUNNING, MFP_JOB_DONE, MFP_JOB_FAILED };
+
+// Scan backend: WSD SOAP or eSCL (AirScan). AUTO uses eSCL when discovery lists
+// the device with an eSCL, AirScan or uscanner service on the port being scanned.
+enum MFPScanProtocol { MFP_SCAN_AUTO, MFP_SCAN_WSD, MFP_SCAN_ESCL };
+
+// Receives the pages of a batch scan; page counts from 1
+typedef std::function<bool(int page, const uint8_t* data, size_t len)> PageSink;
+
+struct MFPPageStats {
+    int page;
+    size_t bytes;
+    uint32_t millis;   // from RetrieveImage (or NextDocument) request to last byte
+    float kbPerSec;
+};
+
+struct MFPBatchStats {
+    int pages;
+    size_t bytes;
+    uint32_t millis;   // whole batch, including CreateScanJob
+    float kbPerSec;
+};
+
+// Prepared scans: tickets created ahead of time and how much waiting they saved
+struct MFPPreparedStats {
+    uint32_t tickets;        // CreateScanJob calls made ahead of time, refreshes included
+    uint32_t refreshes;      // tickets replaced before the device could drop them
+    uint32_t hits;           // scans that went straight to RetrieveImage
+    uint32_t misses;         // scans of the prepared device that created their own job
+    float hitRate;           // hits / (hits + misses)
+    uint32_t savedMillis;    // CreateScanJob round trips skipped by hits
+    float hitFirstByteMs;    // mean time from the scan call to the first image byte, hits
+    float missFirstByteMs;   // the same for misses; the gap includes the warm-up saved
+};
+
+// Fills buffer with up to size bytes of print data; 0 ends the job
+typedef std::function<size_t(uint8_t* buffer, size_t size)> PrintSource;
+
+struct MFPPrintStats {
+    size_t bytes;
+    uint32_t millis;   // connect to last byte handed to the socket
+    float kbPerSec;
+};
+
+// Called after a page has been handed off (written or passed to the sink)
+typedef std::function<void(const MFPPageStats& page)> PageDoneHandler;
+
+// A scan started at the device panel with this board as destination (WS-Eventing ScanAvailableEvent)
+struct MFPScanEvent {
+    char host[64];            // device of the subscription
+    uint16_t port;
+    char scanIdentifier[64];
+    uint32_t receivedAt;      // millis() when the event arrived
+};
+
+// Called from handleEvents(); a scan started inside it answers the event
+typedef std::function<void(const MFPScanEvent& event)> ScanEventHandler;
+
+// Per-phase instrumentation of scans and prints. Off by default; build the library
+// with -DARDUINOMFP_STATS=1 to record it. The types and members are there either
+// way, so the class layout does not depend on the flag; when off, the recording
+// code is not compiled in, getStats() stays zero and the hook is never called.
+#ifndef ARDUINOMFP_STATS
+#define ARDUINOMFP_STATS 0
+#endif
+
+// Scans pass CONNECTED..BODY once per SOAP exchange (CreateScanJob, each RetrieveImage)
+enum MFPPhase : uint8_t {
+    MFP_PHASE_START,       // job accepted
+    MFP_PHASE_CONNECTED,   // socket ready, pooled or new
+    MFP_PHASE_SENT,        // request (or all print data) written
+    MFP_PHASE_FIRST_BYTE,  // first response byte read
+    MFP_PHASE_HEADERS,     // response headers parsed
+    MFP_PHASE_BODY,        // response body complete
+    MFP_PHASE_SAVED,       // image written to the filesystem
+    MFP_PHASE_RETRY,       // exchange retried on a fresh connection
+    MFP_PHASE_DONE,        // job finished; see ok
+    MFP_PHASE_COUNT
+};
+
+struct MFPStats {
+    bool printing;
+    bool ok;
+    uint32_t phaseMicros[MFP_PHASE_COUNT];  // last time each phase was reached, from START
+    // Time spent per phase, summed over all exchanges
+    uint32_t connectMicros;
+    uint32_t sendMicros;       // request or print data
+    uint32_t waitMicros;       // request sent to first byte
+    uint32_t headerMicros;     // first byte to end of headers
+    uint32_t transferMicros;   // end of headers to end of body
+    uint32_t saveMicros;       // filesystem writes
+    uint32_t stageMicros;      // processing stages, part of transferMicros
+    uint32_t totalMicros;
+    size_t bytes;              // image bytes received or print bytes sent
+    float bytesPerSec;
+    uint16_t reallocations;    // image buffer growths
+    uint8_t retries;
+    uint8_t exchanges;
+    uint32_t peakHeap;         // most heap in use above the level at START, sampled per block
+};
+
+typedef std::function<void(MFPPhase phase, const MFPStats& stats)> MFPStatsHook;
+
+// Thread safety: an instance may be used by one task at a time; it is not locked.
+// Jobs keep their state per instance (message IDs come from a per-instance
+// generator), so one instance per task or per device can run in parallel. Shared
+// objects are locked: a buffer pool passed to setBufferPool(), and the discovery
+// and capability caches, of which all instances use the same one, so a device
+// found or queried by one instance is known to the others. MFPScheduler builds on
+// this to run jobs for several devices across both cores.
 class ArduinoMFP {
 public:
-    ArduinoMFP();
+    ArduinoMFP() : ArduinoMFP(MFPBuildLayout::check()) {}
     ~ArduinoMFP();
 
     // Scan method returns pointer to image data or nullptr if failed
-    uint8_t* scan(int height, int width, const char* origin, const char* url, int port, const char* format, int filesystem);
+    uint8_t* scan(int height, int width, const char* origin, const char* url, int port, const char* format, int filesystem = -1);
+    // Streaming scans push the image to the sink chunk by chunk instead of buffering it
+    bool scan(int height, int width, const char* origin, const char* url, int port, const char* format, ScanSink sink);
+    bool scan(int height, int width, const char* origin, const char* url, int port, const char* format, Print& out);
+    // Writes the image to flash while it arrives, through two alternating buffers.
+    // A printf conversion in path gets the first unused number, e.g. "/scan_%03d.jpg".
+    bool scan(int height, int width, const char* origin, const char* url, int port, const char* format, int filesystem, const char* path);
+    // Direct-to-flash scans need this much free space to start (default 64 KB; the max
+    // image size when one is set) and fail early if the announced image is larger
+    void setMinFreeSpace(size_t bytes);
+    const String& getLastPath() const;  // file written by the last direct-to-flash scan
     size_t getImageSize() const;
+    // Scans larger than this are rejected (0 = no limit)
+    void setMaxImageSize(size_t bytes);
+    // Image buffers come from a pool and are reused across scans; pass a shared
+    // pool (e.g. one using MFPPsramAllocator) or nullptr for the built-in one
+    void setBufferPool(MFPBufferPool* bufferPool);
+    MFPBufferPool& getBufferPool();
+    // Give up when a device sends nothing for this long (default 5 s)
+    void setTimeout(uint32_t ms);
+    void setConnectTimeout(uint32_t ms);
+    // SOAP calls reuse HTTP keep-alive connections per host; idle ones close after idleMs
+    void setKeepAlive(bool enable, uint32_t idleMs = 15000);
+    void closeConnections();
+    MFPConnectionPool& getConnectionPool();
     uint8_t* getImageBuffer() const;
-    String look(int mode);
-    String print(const char* url, int port, String payload);
+
+    // Non-blocking versions: start a job, then call poll() from loop() until it
+    // returns MFP_JOB_DONE or MFP_JOB_FAILED. Each poll() returns after the poll
+    // budget or as soon as it would wait for the device. Sinks and Print targets
+    // must outlive the job. Only one job runs per instance.
+    bool beginScan(int height, int width, const char* origin, const char* url, int port, const char* format, int filesystem = -1);
+    bool beginScan(int height, int width, const char* origin, const char* url, int port, const char* format, ScanSink sink);
+    bool beginScan(int height, int width, const char* origin, const char* url, int port, const char* format, Print& out);
+    bool beginScan(int height, int width, const char* origin, const char* url, int port, const char* format, int filesystem, const char* path);
+    // The text is moved into the job: pass a temporary or std::move(text) to avoid
+    // copying it; a String the caller keeps is copied once
+    bool beginPrint(const char* url, int port, String payload);
+    bool beginPrint(const char* url, int port, Stream& data);
+    bool beginPrint(const char* url, int port, PrintSource source);
+
+    // Feeder batches: one scan job, one RetrieveImage per page until the device
+    // reports no more images. Pages go to the sink or to numbered files built
+    // from pathTemplate (printf style, page number from 1). Returns pages scanned.
+    int scanBatch(int height, int width, const char* origin, const char* url, int port, const char* format, PageSink sink);
+    int scanBatch(int height, int width, const char* origin, const char* url, int port, const char* format, int filesystem, const char* pathTemplate = "/scan_%03d.jpg");
+    bool beginBatchScan(int height, int width, const char* origin, const char* url, int port, const char* format, PageSink sink);
+    bool beginBatchScan(int height, int width, const char* origin, const char* url, int port, const char* format, int filesystem, const char* pathTemplate = "/scan_%03d.jpg");
+    void onPage(PageDoneHandler handler);
+    const MFPBatchStats& getBatchStats() const;
+    // Processing stages (checksums, JPEG probe, thumbnail...) see every scanned
+    // image, and each page of a batch, block by block as it arrives, in the order
+    // added. Their results are ready when scan() returns or onPage() is called.
+    bool addStage(MFPStage& stage);  // false when MFP_MAX_STAGES are set
+    void clearStages();
+    // Same calls and sinks for both backends; eSCL takes the same origins (ADF and
+    // ADFDuplex select the feeder) and WSD format names or MIME types
+    void setScanProtocol(MFPScanProtocol protocol);
+    MFPScanProtocol getScanProtocol() const;
+
+    // Push scans (WS-Eventing): subscribes to the device's ScanAvailableEvent, which
+    // lists this board as displayName among the scan destinations on the panel, and
+    // listens on listenPort for deliveries. Call handleEvents() from loop(): it takes
+    // events, renews the subscription before it lapses and calls the handler. A scan
+    // started inside the handler answers the event, so the device starts at once.
+    // One subscription per instance; instances need different listen ports.
+    bool subscribeScans(const char* url, int port, ScanEventHandler handler, const char* displayName = "ESP32", uint16_t listenPort = 5357, uint32_t expiresSec = 3600);
+    void unsubscribeScans();
+    bool scansSubscribed() const;
+    void handleEvents();
+
+    // Prepared scans (WSD): creates the scan job ahead of time and holds its ticket
+    // (JobId and JobToken), so the next scan of the device with the same settings
+    // goes straight to RetrieveImage while the device is already warming up. Call
+    // handlePrepared() from loop(): it replaces the ticket every refreshMs, before
+    // the device drops it, makes a new one after each scan that used it, and cancels
+    // it once holdMs pass without such a scan. A scan of the device with other
+    // settings cancels the ticket first, as most devices run one job at a time.
+    bool prepareScan(int height, int width, const char* origin, const char* url, int port, const char* format, uint32_t holdMs = 300000, uint32_t refreshMs = 30000);
+    void cancelPrepared();
+    bool scanPrepared() const;  // a ticket is held right now
+    void handlePrepared();
+    const MFPPreparedStats& getPreparedStats() const;
+
+    MFPJobState poll();
+    MFPJobState getJobState() const;
+    void cancelJob();
+    size_t getJobBytes() const;  // image bytes received or print bytes sent
+    long getJobTotal() const;    // expected bytes, -1 if unknown
+    const String& getPrintOutput() const;
+    void setPollBudget(uint32_t ms);  // default 10 ms
+
+    // mode 0 = printers, 1 = scanners. Results come from a per-device cache and
+    // list every service a device advertises; refresh forces new mDNS queries
+    String look(int mode, bool refresh = false);
+    // Structured form: fills up to max devices, returns how many
+    size_t look(int mode, MFPDevice* devices, size_t max, bool refresh = false);
+    MFPDiscovery& getDiscovery();  // shared by all instances
+    String print(const char* url, int port, const String& payload);
+    // Streams a document (PDF, PCL, raster...) in blocks without holding it in RAM.
+    // Returns once all data is handed to the socket; no reply is awaited.
+    bool print(const char* url, int port, Stream& data);
+    bool print(const char* url, int port, PrintSource source);
+    const MFPPrintStats& getPrintStats() const;
+    // IPP Print-Job: the document is streamed with chunked transfer encoding over a
+    // pooled connection. Returns the printer's job-id, 0 on failure. format is the
+    // document's MIME type, path the printer's resource (its "rp" TXT record).
+    int printIpp(const char* url, int port, Stream& data, const char* format = "application/octet-stream", const char* path = "/ipp/print");
+    int printIpp(const char* url, int port, PrintSource source, const char* format = "application/octet-stream", const char* path = "/ipp/print");
+    bool beginIppPrint(const char* url, int port, Stream& data, const char* format = "application/octet-stream", const char* path = "/ipp/print");
+    bool beginIppPrint(const char* url, int port, PrintSource source, const char* format = "application/octet-stream", const char* path = "/ipp/print");
+    int getIppJobId() const;  // job-id from the last IPP print, 0 if none
+    // One small Get-Job-Attributes asking only for job-state; MFP_IPP_UNKNOWN if the
+    // printer could not be asked. Several jobs can be sent first and followed later.
+    MFPIppJobState getIppJobState(const char* url, int port, int jobId, const char* path = "/ipp/print");
     String supported(const char* url, int port);
+    // Structured form; false if the device could not be queried
+    bool supported(const char* url, int port, MFPDeviceInfo& info);
+    // Metadata plus scanner configuration, from the cache when present. Once a
+    // device is cached, scans to it are checked locally before a job is sent.
+    bool getCapabilities(const char* url, int port, MFPCapabilities& caps, bool refresh = false);
+    MFPCapabilityCache& getCapabilityCache();  // shared by all instances
+    // Stats of the last (or running) scan or print; all zero unless ARDUINOMFP_STATS is set
+    const MFPStats& getStats() const;
+    // Called at every phase; keep it short, it runs inside the job
+    void onStats(MFPStatsHook hook);
 
 private:
+    explicit ArduinoMFP(MFPBuildLayout layout);
+
     uint8_t* imageBuffer;
     size_t imageSize;
+    size_t imageCapacity;
+    size_t expectedImageSize;
+    size_t maxImageSize;
+    MFPBufferPool defaultPool;
+    MFPBufferPool* pool;
+    uint32_t responseTimeout;
+    uint32_t connectTimeout;
+    bool keepAlive;
+    MFPConnectionPool connections;
+    static MFPDiscovery discovery;
+    static MFPCapabilityCache capabilities;
+    MFPScanProtocol scanProtocol;
+    uint8_t ioBuffer[MFP_BLOCK_SIZE];  // socket reads land here
+
+    uint64_t rngState;
+    uint32_t nextRandom();
+    void generateUUID(char* uuid);  // uuid must hold 37 chars
+    enum HttpResult { HTTP_RESULT_OK, HTTP_RESULT_CONNECT_FAILED, HTTP_RESULT_TIMEOUT, HTTP_RESULT_ERROR, HTTP_RESULT_PENDING };
+
+    // One SOAP request/response exchange that can be resumed across polls
+    struct SoapCall {
+        WiFiClient* client = nullptr;
+        bool reused = false;
+        int attempt = 0;
+        unsigned long lastData = 0;
+        MFPHttpResponse response;
+        bool gotData = false;      // stats only
+        bool gotHeaders = false;
+    };
+
+    enum JobStep { JOB_IDLE, JOB_CREATE, JOB_CREATE_READ, JOB_RETRIEVE, JOB_RETRIEVE_READ, JOB_SAVE, JOB_PAGE_DONE,
+                   JOB_ESCL_CREATE, JOB_ESCL_CREATE_READ, JOB_ESCL_NEXT, JOB_ESCL_NEXT_READ, JOB_ESCL_DELETE, JOB_ESCL_DELETE_READ,
+                   JOB_IPP_CONNECT, JOB_IPP_SEND, JOB_IPP_READ,
+                   JOB_PRINT_CONNECT, JOB_PRINT_SEND, JOB_PRINT_READ, JOB_DONE, JOB_FAILED };
+
+    struct Job {
+        JobStep step;
+        String host;
+        int port;
+        bool printing;
+
+        // Scan
+        int height;
+        int width;
+        String origin;
+        String format;
+        ScanSink sink;
+        bool buffered;
+        int filesystem;
+        char uuid[37];
+        String id;          // eSCL: NextDocument path
+        String esclJob;     // eSCL: job path, until the job is deleted
+        JobStep afterDelete;  // eSCL: where the job goes once it is deleted
+        String token;
+        String scanIdentifier;  // answers a ScanAvailableEvent when set
+        bool ticketUsed;        // started from a prepared ticket
+        bool timeFirstByte;     // counts for the prepared stats; first image byte still to come
+        unsigned long scanStart;
+        bool escl;
+        size_t bodyBytes;   // eSCL: document bytes received
+        int busyRetries;    // eSCL: 503 answers to NextDocument in a row
+        unsigned long retryAt;
+        SoapCall call;
+        MFPXmlParser xml;
+        MFPMultipartParser parser;
+        bool parserStarted;
+        bool stagesStarted;  // stages have seen the first block of the image
+        bool faultBody;
+        String fault;
+        File file;
+        size_t saved;
+        bool direct;           // streamed to flash by writer
+        MFPFileWriter writer;
+        String path;
+        size_t freeSpace;
+
+        // Batch
+        bool batch;
+        PageSink pageSink;
+        String pathTemplate;
+        bool pageReady;     // last page received but not yet handed off
+        const char* failAfterPage;  // failure reported once that page is handed off
+        MFPPageStats page;
+        unsigned long pageStart;
+        unsigned long batchStart;
+
+        // Print
+        WiFiClient printClient;
+        PrintSource source;
+        String payload;
+        size_t textOffset;
+        uint8_t* block;     // from the buffer pool while a print job runs
+        size_t blockLen;
+        size_t blockSent;
+        size_t sent;
+        long printTotal;
+        bool collectReply;  // text prints wait for the printer's answer
+        String output;
+        unsigned long printStart;
+        unsigned long replyStart;
+        unsigned long lastWrite;  // last write that took data, for the send timeout
+
+        // IPP print, sent over call
+        bool ipp;
+        String ippPath;
+        String ippFormat;
+        bool lastChunk;
+        int ippJobId;
+        MFPIppResponse ippResponse;
+    };
+
+    struct Subscription {
+        bool active;
+        String host;
+        int port;
+        String displayName;
+        uint16_t listenPort;
+        uint32_t requested;       // seconds asked for
+        uint32_t expires;         // seconds granted
+        unsigned long renewedAt;
+        char identifier[37];      // ours; the device sends it back with every event
+        String manager;           // subscription manager address for Renew/Unsubscribe
+        String managerId;
+        String destinationToken;  // goes into CreateScanJob with the scan identifier
+        ScanEventHandler handler;
+        bool eventPending;        // arrived while a job was running
+        MFPScanEvent event;
+
+        // Delivery being received; each handleEvents() reads what has arrived
+        bool receiving;
+        WiFiClient delivery;
+        MFPHttpResponse request;
+        MFPXmlParser xml;
+        MFPScanEvent incoming;
+        char deliveredTo[48];     // Identifier header of the delivery
+        unsigned long deliveryData;
+    };
+
+    struct Prepared {
+        bool armed;               // from prepareScan() until the hold is over
+        String host;
+        int port;
+        int height;
+        int width;
+        String origin;
+        String format;
+        uint32_t holdMs;
+        uint32_t refreshMs;
+        unsigned long usedAt;     // prepareScan() or the last hit; the hold counts from here
+        unsigned long retryAt;    // next attempt to create a ticket
+        bool ticket;              // id and token are valid
+        char uuid[37];            // From address the job was created with
+        String id;
+        String token;
+        unsigned long createdAt;
+        uint32_t createMillis;    // round trip of the CreateScanJob that made the ticket
+    };
+
+    Job job;
+    Prepared prepared;
+    MFPPreparedStats preparedStats;
+    Subscription subscription;
+    WiFiServer eventServer;
+    const MFPScanEvent* answering;  // event the handler is answering, nullptr otherwise
+    uint32_t ippRequestId;
+    uint32_t pollBudget;
+    size_t minFreeSpace;
+    MFPBatchStats batchStats;
+    PageDoneHandler pageHandler;
+    MFPStage* stages[MFP_MAX_STAGES];
+    uint8_t stageCount;
+    MFPPrintStats printStats;
+    MFPStats stats;
+    MFPStatsHook statsHook;
+    bool statsOpen;
+    uint32_t statsMarks[MFP_PHASE_COUNT];  // micros() of the latest occurrence
+    uint32_t exchangeStart;
+    uint32_t heapBase;
+
+    void statsBegin(bool printing);
+    void statsPhase(MFPPhase phase);
+    void statsCall(const SoapCall& call, MFPPhase phase);  // only for the job's own exchanges
+    void statsHeap();
+    void statsEnd();
+
+    HttpResult openRequest(SoapCall& call, const String& host, int port);
+    // body may be nullptr for a GET; SOAP calls are POSTs of an envelope
+    HttpResult startRequest(SoapCall& call, const String& host, int port, const char* method, const char* path, const char* contentType, const MFPSoapTemplate* body, const MFPSoapSlots& slots);
+    HttpResult startSoap(SoapCall& call, const String& host, int port, const char* path, const MFPSoapTemplate& soap, const MFPSoapSlots& slots);
+    HttpResult pumpSoap(SoapCall& call, const HttpBodySink& sink, uint32_t budgetMs);
+    bool finishSoap(SoapCall& call, HttpResult result);  // true if the call should be retried
+    // contentLength -1 = chunked; no contentType = no body
+    void writeHeaders(Print& out, const char* method, const String& host, int port, const char* path, const char* contentType, long contentLength);
+    // A chunked request goes out as its first chunk; the document follows
+    HttpResult startIpp(SoapCall& call, const String& host, int port, const char* path, const MFPIppWriter& request, bool chunked);
+    HttpResult runCall(SoapCall& call, const std::function<HttpResult()>& start, const HttpBodySink& sink);
+    bool writeRequest(Print& out, const char* method, const String& host, int port, const char* path, const char* contentType, const MFPSoapTemplate* body, const MFPSoapSlots& slots);
+    HttpResult postSoap(const String& host, int port, const char* path, const MFPSoapTemplate& soap, const MFPSoapSlots& slots, SoapCall& call, const HttpBodySink& sink);
+    HttpResult sendSoapRequest(const String& host, int port, const MFPSoapTemplate& soap, const MFPSoapSlots& slots, MFPXmlParser& xml, const char* path = "/WebServices/ScannerService");
 
-    String generateUUID();
-    String buildCreateScanJobSOAP(const String& messageID, const String& jobUUID, int height, int width, const String& origin, const String& format);
-    String buildRetrieveImageSOAP(const String& messageID, const String& jobUUID, const String& jobId, const String& jobToken);
-    String sendSoapRequest(const String& host, int port, const String& soapBody);
-    bool createScanJob(const String& host, int port, int height, int width, const String& origin, const String& format, String& jobUUID, String& jobId, String& jobToken);
-    bool retrieveImage(const String& host, int port, const String& jobUUID, const String& jobId, const String& jobToken);
+    HttpResult queryMetadata(const char* url, int port, MFPDeviceInfo& info);
+    HttpResult queryScannerElements(const char* url, int port, const char* path, MFPScannerCaps& scanner);
+    uint8_t lookServices(int mode, bool refresh);
 
-    String extractTag(const String& data, const String& tag);
+    bool useEscl(const char* url, int port);
+    static const char* esclFormat(const String& format);
+    bool sendSubscribe();
+    bool renewScans();
+    void sendUnsubscribe();
+    bool readEvent();
+    bool createTicket();
+    void cancelTicket();
+    void usePrepared();
+    void preparedFirstByte();
+    bool jobActive() const;
+    bool stepJob(uint32_t budgetMs);  // false when waiting for the device
+    bool soapFailed(HttpResult result, JobStep retryStep);
+    bool imageAnnounced(long length);  // false rejects the image
+    bool deliver(const uint8_t* data, size_t len);  // stages, then the job's sink
+    bool imageReceived();
+    size_t jobImageBytes() const;
+    long jobImageLength() const;
+    bool failJob(const char* message);
+    void deleteEsclJob();
+    bool beginPrint(const char* url, int port, PrintSource source, long total, bool collectReply);
+    static size_t readText(const String& text, size_t& offset, uint8_t* buffer, size_t size);
+    static PrintSource streamSource(Stream& data);
+    void startIppJob(const char* format, const char* path);
+    void endPrint();
+    void dropDirectFile();
+    void startBatch();
+    void pageDone();
+    void finishBatch();
+    MFPJobState finishJob();
 
+    bool appendImage(const uint8_t* data, size_t len);
     void freeImageBuffer();
 };
 
@@ -0,0 +1,218 @@
+#include "MFPBufferPool.h"
+#include <stdlib.h>
+#if defined(ESP32)
+#include <esp_heap_caps.h>
+#endif
+
+static void* heapAllocate(size_t size) {
+    return malloc(size);
+}
+
+static void* heapReallocate(void* ptr, size_t size) {
+    return realloc(ptr, size);
+}
+
+static void heapRelease(void* ptr) {
+    free(ptr);
+}
+
+#if defined(ESP32)
+static void* psramAllocate(size_t size) {
+    void* ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    return ptr ? ptr : malloc(size);
+}
+
+static void* psramReallocate(void* ptr, size_t size) {
+    void* moved = heap_caps_realloc(ptr, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    return moved ? moved : realloc(ptr, size);
+}
+#else
+#define psramAllocate heapAllocate
+#define psramReallocate heapReallocate
+#endif
+
+const MFPAllocator MFPHeapAllocator = { heapAllocate, heapReallocate, heapRelease };
+// free() releases heap_caps memory of any kind on ESP-IDF
+const MFPAllocator MFPPsramAllocator = { psramAllocate, psramReallocate, heapRelease };
+
+// Holds the pool mutex for the rest of the scope, so early returns unlock it
+class PoolLock {
+public:
+    explicit PoolLock(SemaphoreHandle_t lock) : lock(lock) { xSemaphoreTakeRecursive(lock, portMAX_DELAY); }
+    ~PoolLock() { xSemaphoreGiveRecursive(lock); }
+
+private:
+    SemaphoreHandle_t lock;
+};
+
+MFPBufferPool::MFPBufferPool(const MFPAllocator& allocator) : alloc(allocator) {
+    memset(slots, 0, sizeof(slots));
+    memset(&stats, 0, sizeof(stats));
+    lock = xSemaphoreCreateRecursiveMutex();
+}
+
+MFPBufferPool::~MFPBufferPool() {
+    for (int i = 0; i < maxSlots; i++) {
+        if (slots[i].data && !slots[i].arena) alloc.release(slots[i].data);
+    }
+    vSemaphoreDelete(lock);
+}
+
+bool MFPBufferPool::setAllocator(const MFPAllocator& allocator) {
+    PoolLock hold(lock);
+    for (int i = 0; i < maxSlots; i++) {
+        if (slots[i].inUse && !slots[i].arena) return false;
+    }
+    trim();
+    alloc = allocator;
+    return true;
+}
+
+bool MFPBufferPool::addArena(uint8_t* memory, size_t size) {
+    PoolLock hold(lock);
+    if (!memory || size == 0) return false;
+    Slot* slot = emptySlot();
+    if (!slot) return false;
+    slot->data = memory;
+    slot->size = size;
+    slot->arena = true;
+    stats.reserved += size;
+    return true;
+}
+
+MFPBufferPool::Slot* MFPBufferPool::find(uint8_t* buffer) {
+    for (int i = 0; i < maxSlots; i++) {
+        if (slots[i].data == buffer) return &slots[i];
+    }
+    return nullptr;
+}
+
+MFPBufferPool::Slot* MFPBufferPool::emptySlot() {
+    return find(nullptr);
+}
+
+// Smallest idle buffer that is big enough, but not one that other instances
+// sharing the pool will need for a large image
+MFPBufferPool::Slot* MFPBufferPool::idleFit(size_t minSize) {
+    Slot* best = nullptr;
+    for (int i = 0; i < maxSlots; i++) {
+        Slot& s = slots[i];
+        if (!s.data || s.inUse || s.size < minSize || s.size / maxOvershoot > minSize) continue;
+        if (!best || s.size < best->size) best = &s;
+    }
+    return best;
+}
+
+void MFPBufferPool::handOut(Slot* slot, size_t& capacity) {
+    slot->inUse = true;
+    capacity = slot->size;
+    if (slot->size > stats.highWater) stats.highWater = slot->size;
+}
+
+uint8_t* MFPBufferPool::acquire(size_t minSize, size_t& capacity) {
+    PoolLock hold(lock);
+    capacity = 0;
+
+    Slot* best = idleFit(minSize);
+    if (best) {
+        stats.reuses++;
+        handOut(best, capacity);
+        return best->data;
+    }
+
+    // Otherwise replace the largest idle heap buffer that is too small, or take
+    // an empty slot; an idle buffer too large to lend goes only when all slots are taken
+    Slot* slot = nullptr;
+    for (int i = 0; i < maxSlots; i++) {
+        Slot& s = slots[i];
+        if (!s.data || s.inUse || s.arena || s.size >= minSize) continue;
+        if (!slot || s.size > slot->size) slot = &s;
+    }
+    if (!slot) slot = emptySlot();
+    for (int i = 0; i < maxSlots && !slot; i++) {
+        Slot& s = slots[i];
+        if (s.data && !s.inUse && !s.arena) slot = &s;
+    }
+    if (!slot) return nullptr;
+    if (slot->data) {
+        alloc.release(slot->data);
+        stats.reserved -= slot->size;
+        slot->data = nullptr;
+        slot->size = 0;
+    }
+
+    uint8_t* data = (uint8_t*)alloc.allocate(minSize);
+    if (!data) return nullptr;
+    slot->data = data;
+    slot->size = minSize;
+    slot->arena = false;
+    stats.allocations++;
+    stats.reserved += minSize;
+    handOut(slot, capacity);
+    return data;
+}
+
+uint8_t* MFPBufferPool::grow(uint8_t* buffer, size_t used, size_t newSize, size_t& capacity) {
+    PoolLock hold(lock);
+    Slot* slot = find(buffer);
+    if (!buffer || !slot) return acquire(newSize, capacity);
+    if (slot->size >= newSize) {
+        capacity = slot->size;
+        return buffer;
+    }
+
+    if (slot->arena) {
+        // Arenas cannot grow; move the data to a bigger buffer
+        size_t newCapacity;
+        uint8_t* moved = acquire(newSize, newCapacity);
+        if (!moved) return nullptr;
+        memcpy(moved, buffer, used);
+        slot->inUse = false;
+        capacity = newCapacity;
+        return moved;
+    }
+
+    // A buffer growing without a known size (e.g. a chunked image) moves into an
+    // idle one that fits, so the large buffer of the last scan is still reused
+    Slot* idle = idleFit(newSize);
+    if (idle) {
+        memcpy(idle->data, buffer, used);
+        slot->inUse = false;
+        stats.reuses++;
+        handOut(idle, capacity);
+        return idle->data;
+    }
+
+    uint8_t* data = (uint8_t*)alloc.reallocate(buffer, newSize);
+    if (!data) return nullptr;
+    stats.allocations++;
+    stats.reserved += newSize - slot->size;
+    slot->data = data;
+    slot->size = newSize;
+    handOut(slot, capacity);
+    return data;
+}
+
+void MFPBufferPool::release(uint8_t* buffer) {
+    if (!buffer) return;
+    PoolLock hold(lock);
+    Slot* slot = find(buffer);
+    if (slot) slot->inUse = false;
+}
+
+void MFPBufferPool::trim() {
+    PoolLock hold(lock);
+    for (int i = 0; i < maxSlots; i++) {
+        Slot& s = slots[i];
+        if (!s.data || s.inUse || s.arena) continue;
+        alloc.release(s.data);
+        stats.reserved -= s.size;
+        s.data = nullptr;
+        s.size = 0;
+    }
+}
+
+MFPBufferPoolStats MFPBufferPool::getStats() const {
+    PoolLock hold(lock);
+    return stats;
+}
@@ -0,0 +1,76 @@
+#ifndef MFPBufferPool_h
+#define MFPBufferPool_h
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#ifndef MFP_POOL_SLOTS
+#define MFP_POOL_SLOTS 8  // buffers a pool tracks; a job holds up to two, so 2 x MFP_SCHEDULER_SLOTS when shared
+#endif
+
+// Pluggable allocator for image buffers, e.g. to place them in PSRAM
+struct MFPAllocator {
+    void* (*allocate)(size_t size);
+    void* (*reallocate)(void* ptr, size_t size);
+    void (*release)(void* ptr);
+};
+
+extern const MFPAllocator MFPHeapAllocator;
+// PSRAM when the board has it, internal heap otherwise
+extern const MFPAllocator MFPPsramAllocator;
+
+struct MFPBufferPoolStats {
+    size_t highWater;      // largest buffer size handed out so far
+    size_t reserved;       // bytes currently held by the pool (in use or idle)
+    uint32_t allocations;  // requests that needed a new allocation or a growth
+    uint32_t reuses;       // requests served from an idle buffer without allocating
+};
+
+// Keeps image buffers alive between scans so repeated scans reuse the same
+// memory instead of fragmenting the heap. Calls are serialized by a mutex, so
+// one pool may be shared by instances running in different tasks.
+class MFPBufferPool {
+public:
+    explicit MFPBufferPool(const MFPAllocator& allocator = MFPHeapAllocator);
+    ~MFPBufferPool();
+
+    // Frees idle buffers and switches allocator; fails while a buffer is in use
+    bool setAllocator(const MFPAllocator& allocator);
+    // Caller-provided memory used before the allocator; never freed by the pool
+    bool addArena(uint8_t* memory, size_t size);
+
+    // Returns a buffer of at least minSize bytes; capacity receives its real size.
+    // An idle buffer is reused only up to maxOvershoot times minSize.
+    uint8_t* acquire(size_t minSize, size_t& capacity);
+    // Enlarges a buffer from acquire(), keeping the first used bytes
+    uint8_t* grow(uint8_t* buffer, size_t used, size_t newSize, size_t& capacity);
+    // Hands a buffer back for reuse
+    void release(uint8_t* buffer);
+    // Frees all idle buffers
+    void trim();
+
+    MFPBufferPoolStats getStats() const;
+
+private:
+    struct Slot {
+        uint8_t* data;
+        size_t size;
+        bool inUse;
+        bool arena;
+    };
+    static const int maxSlots = MFP_POOL_SLOTS;
+    static const size_t maxOvershoot = 4;
+
+    MFPAllocator alloc;
+    Slot slots[maxSlots];
+    MFPBufferPoolStats stats;
+    SemaphoreHandle_t lock;  // recursive: grow() and setAllocator() call other methods
+
+    Slot* find(uint8_t* buffer);
+    Slot* emptySlot();
+    Slot* idleFit(size_t minSize);
+    void handOut(Slot* slot, size_t& capacity);
+};
+
+#endif
@@ -0,0 +1,203 @@
+#include "MFPCapabilities.h"
+
+static const uint32_t cacheMagic = 0x4350464d;  // "MFPC"
+static const uint16_t cacheVersion = 1;
+
+// Holds the cache mutex for the rest of the scope, so early returns unlock it
+class CacheLock {
+public:
+    explicit CacheLock(SemaphoreHandle_t lock) : lock(lock) { xSemaphoreTakeRecursive(lock, portMAX_DELAY); }
+    ~CacheLock() { xSemaphoreGiveRecursive(lock); }
+
+private:
+    SemaphoreHandle_t lock;
+};
+
+MFPCapabilityCache::MFPCapabilityCache() : count(0), storage(nullptr), hits(0), misses(0) {
+    path[0] = 0;
+    lock = xSemaphoreCreateRecursiveMutex();
+}
+
+MFPCapabilityCache::~MFPCapabilityCache() {
+    vSemaphoreDelete(lock);
+}
+
+bool MFPCapabilityCache::setStorage(fs::FS* fs, const char* file) {
+    CacheLock hold(lock);
+    storage = fs;
+    strlcpy(path, file ? file : "", sizeof(path));
+    return storage ? load() : true;
+}
+
+bool MFPCapabilityCache::load() {
+    CacheLock hold(lock);
+    if (!storage || !path[0]) return false;
+    File f = storage->open(path, "r");
+    if (!f) return false;
+
+    // Files from another build or layout are ignored and rewritten on the next save
+    Header header;
+    if (f.read((uint8_t*)&header, sizeof(header)) != sizeof(header) || header.magic != cacheMagic ||
+        header.version != cacheVersion || header.entrySize != sizeof(MFPCapabilities) || header.count > MFP_MAX_CACHED_DEVICES) {
+        f.close();
+        return false;
+    }
+    size_t n = 0;
+    while (n < header.count && f.read((uint8_t*)&entries[n], sizeof(MFPCapabilities)) == sizeof(MFPCapabilities)) {
+        entries[n].host[sizeof(entries[n].host) - 1] = 0;
+        used[n] = 0;
+        n++;
+    }
+    f.close();
+    count = n;
+    return true;
+}
+
+bool MFPCapabilityCache::save() {
+    CacheLock hold(lock);
+    if (!storage || !path[0]) return false;
+    File f = storage->open(path, "w");
+    if (!f) {
+        Serial.println("Failed to open capability cache file");
+        return false;
+    }
+    Header header = {cacheMagic, cacheVersion, (uint16_t)sizeof(MFPCapabilities), (uint32_t)count};
+    bool ok = f.write((const uint8_t*)&header, sizeof(header)) == sizeof(header);
+    for (size_t i = 0; ok && i < count; i++) {
+        ok = f.write((const uint8_t*)&entries[i], sizeof(MFPCapabilities)) == sizeof(MFPCapabilities);
+    }
+    f.close();
+    if (!ok) Serial.println("Failed to write capability cache file");
+    return ok;
+}
+
+int MFPCapabilityCache::indexOf(const char* key) const {
+    if (!key || !key[0]) return -1;
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(entries[i].host, key) == 0 || strcmp(entries[i].info.uuid, key) == 0) return i;
+    }
+    return -1;
+}
+
+const MFPCapabilities* MFPCapabilityCache::find(const char* host) const {
+    CacheLock hold(lock);
+    int i = indexOf(host);
+    if (i < 0 || entries[i].stale) return nullptr;
+    ((MFPCapabilityCache*)this)->used[i] = millis();
+    return &entries[i];
+}
+
+bool MFPCapabilityCache::get(const char* host, MFPCapabilities& caps) const {
+    CacheLock hold(lock);
+    const MFPCapabilities* entry = find(host);
+    if (!entry) return false;
+    caps = *entry;
+    return true;
+}
+
+const MFPCapabilities& MFPCapabilityCache::store(const MFPCapabilities& caps) {
+    CacheLock hold(lock);
+    // The same device under a new address replaces its old entry
+    int i = indexOf(caps.info.uuid);
+    if (i < 0) i = indexOf(caps.host);
+    uint32_t version = caps.metadataVersion;
+    if (i >= 0) {
+        // A refetch keeps the version last announced for this device
+        if (version == 0 && strcmp(entries[i].info.uuid, caps.info.uuid) == 0) version = entries[i].metadataVersion;
+    } else if (count < MFP_MAX_CACHED_DEVICES) {
+        i = count++;
+    } else {
+        i = 0;
+        for (size_t k = 1; k < count; k++) {
+            if ((int32_t)(used[k] - used[i]) < 0) i = k;
+        }
+    }
+    entries[i] = caps;
+    entries[i].metadataVersion = version;
+    entries[i].stale = false;
+    used[i] = millis();
+    save();
+    return entries[i];
+}
+
+void MFPCapabilityCache::setMetadataVersion(const char* key, uint32_t version) {
+    CacheLock hold(lock);
+    int i = indexOf(key);
+    if (i < 0 || entries[i].metadataVersion == version) return;
+    entries[i].metadataVersion = version;
+    entries[i].stale = true;
+    save();
+}
+
+void MFPCapabilityCache::invalidate(const char* key) {
+    CacheLock hold(lock);
+    for (size_t i = 0; i < count; i++) {
+        if (!key || (int)i == indexOf(key)) entries[i].stale = true;
+    }
+    save();
+}
+
+static bool hasValue(const uint16_t* values, uint8_t count, int value) {
+    if (count == 0) return true;  // not reported
+    for (uint8_t i = 0; i < count; i++) {
+        if (values[i] == value) return true;
+    }
+    return false;
+}
+
+bool MFPCapabilityCache::check(const char* host, int height, int width, const char* origin, const char* format) const {
+    CacheLock hold(lock);
+    int i = indexOf(host);
+    if (i < 0 || entries[i].stale || !entries[i].hasScanner) return true;
+    const MFPScannerCaps& s = entries[i].scanner;
+
+    if (!hasValue(s.widths, s.widthCount, width) || !hasValue(s.heights, s.heightCount, height)) {
+        Serial.println("Resolution not supported by the scanner");
+        return false;
+    }
+    if (s.sources) {
+        uint8_t source = 0;
+        if (strcmp(origin, "Platen") == 0) source = MFP_SOURCE_PLATEN;
+        else if (strcmp(origin, "ADF") == 0) source = MFP_SOURCE_ADF;
+        else if (strcmp(origin, "ADFDuplex") == 0) source = MFP_SOURCE_ADF_DUPLEX;
+        if (source && !(s.sources & source)) {
+            Serial.println("Input source not supported by the scanner");
+            return false;
+        }
+    }
+    if (s.formatCount) {
+        bool found = false;
+        const char* mime = mimeType(format);
+        for (uint8_t k = 0; k < s.formatCount && !found; k++) found = strcmp(mimeType(s.formats[k]), mime) == 0;
+        if (!found) {
+            Serial.println("Format not supported by the scanner");
+            return false;
+        }
+    }
+    return true;
+}
+
+const char* MFPCapabilityCache::mimeType(const char* format) {
+    if (strcmp(format, "jfif") == 0 || strcmp(format, "exif") == 0 || strcmp(format, "jpeg") == 0) return "image/jpeg";
+    if (strcmp(format, "pdf-a") == 0 || strcmp(format, "pdf") == 0) return "application/pdf";
+    if (strcmp(format, "png") == 0) return "image/png";
+    return format;
+}
+
+uint32_t MFPCapabilityCache::getHits() const {
+    return hits;
+}
+
+uint32_t MFPCapabilityCache::getMisses() const {
+    return misses;
+}
+
+void MFPCapabilityCache::countHit() {
+    CacheLock hold(lock);
+    hits++;
+}
+
+void MFPCapabilityCache::countMiss() {
+    CacheLock hold(lock);
+    misses++;
+}
@@ -0,0 +1,99 @@
+#ifndef MFPCapabilities_h
+#define MFPCapabilities_h
+
+#include <Arduino.h>
+#include <FS.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "MFPDiscovery.h"
+
+#ifndef MFP_MAX_CACHED_DEVICES
+#define MFP_MAX_CACHED_DEVICES 4
+#endif
+
+enum MFPInputSource : uint8_t {
+    MFP_SOURCE_PLATEN     = 0x01,
+    MFP_SOURCE_ADF        = 0x02,
+    MFP_SOURCE_ADF_DUPLEX = 0x04
+};
+
+// What the scanner accepts, from GetScannerElements(ScannerConfiguration)
+struct MFPScannerCaps {
+    static const int maxResolutions = 8;
+    static const int maxFormats = 8;
+
+    uint16_t widths[maxResolutions];   // dpi
+    uint8_t widthCount;
+    uint16_t heights[maxResolutions];
+    uint8_t heightCount;
+    char formats[maxFormats][28];      // e.g. "jfif", "pdf-a", "png"
+    uint8_t formatCount;
+    uint8_t sources;                   // MFPInputSource bits
+};
+
+struct MFPCapabilities {
+    char host[64];                 // address the entry was fetched from
+    uint16_t port;
+    uint32_t metadataVersion;      // as announced by the device, 0 if unknown
+    bool stale;                    // refetch before next use
+    bool hasScanner;
+    MFPDeviceInfo info;
+    MFPScannerCaps scanner;
+};
+
+// Per-device cache of metadata and scanner capabilities, keyed by the
+// device UUID when known and by host otherwise. Entries are reused until the
+// device announces a new metadata version or they are invalidated, and can
+// be kept on SPIFFS/LittleFS so a reboot does not cost a round trip.
+// Calls are serialized by a mutex, so tasks may share one cache.
+class MFPCapabilityCache {
+public:
+    MFPCapabilityCache();
+    ~MFPCapabilityCache();
+
+    // Loads the file now and saves to it after each update
+    bool setStorage(fs::FS* fs, const char* path = "/mfp_caps.bin");
+    bool load();
+    bool save();
+
+    // Cached, non-stale entry for host, or nullptr. The entry may be replaced by
+    // a store() from another task; get() copies it under the lock instead.
+    const MFPCapabilities* find(const char* host) const;
+    bool get(const char* host, MFPCapabilities& caps) const;
+    const MFPCapabilities& store(const MFPCapabilities& caps);
+    // Marks entries stale when version differs from the cached one; key is host or UUID
+    void setMetadataVersion(const char* key, uint32_t version);
+    void invalidate(const char* key = nullptr);  // nullptr = all
+
+    // Checks scan parameters against the cached capabilities. Unknown devices pass.
+    // Formats are compared by MIME type, so "image/jpeg" matches a device reporting "jfif".
+    bool check(const char* host, int height, int width, const char* origin, const char* format) const;
+    // WSD format names ("jfif", "pdf-a", "png"...) as MIME types; anything else passes through
+    static const char* mimeType(const char* format);
+
+    uint32_t getHits() const;
+    uint32_t getMisses() const;
+    void countHit();
+    void countMiss();
+
+private:
+    struct Header {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t entrySize;
+        uint32_t count;
+    };
+
+    MFPCapabilities entries[MFP_MAX_CACHED_DEVICES];
+    uint32_t used[MFP_MAX_CACHED_DEVICES];  // last use, for replacement
+    size_t count;
+    fs::FS* storage;
+    char path[32];
+    uint32_t hits;
+    uint32_t misses;
+    SemaphoreHandle_t lock;  // recursive: store() and setStorage() call other methods
+
+    int indexOf(const char* key) const;
+};
+
+#endif
@@ -0,0 +1,201 @@
+#include "MFPDiscovery.h"
+#include <ESPmDNS.h>
+
+static const char* const serviceNames[MFP_SERVICE_COUNT] = {"ipp", "uscanner", "scanner", "airscan", "escl"};
+
+// ESPmDNS keeps the results of the last query globally, so queries from the
+// background task and the caller must not overlap. Created at startup rather
+// than by the first instance, so instances may be built from several tasks.
+static SemaphoreHandle_t queryLock = xSemaphoreCreateMutex();
+
+uint16_t MFPDevice::port(uint8_t service) const {
+    for (int i = 0; i < MFP_SERVICE_COUNT; i++) {
+        if ((services & service) & (1 << i)) return ports[i];
+    }
+    return 0;
+}
+
+MFPDiscovery::MFPDiscovery(uint32_t ttlMs) : count(0), ttl(ttlMs), queries(0), task(nullptr), running(false), taskAlive(false), backgroundServices(0) {
+    for (int i = 0; i < MFP_SERVICE_COUNT; i++) {
+        lastQuery[i] = 0;
+        queried[i] = false;
+    }
+    lock = xSemaphoreCreateMutex();
+}
+
+MFPDiscovery::~MFPDiscovery() {
+    endBackground();
+    vSemaphoreDelete(lock);
+}
+
+void MFPDiscovery::setTtl(uint32_t ms) {
+    ttl = ms;
+}
+
+const char* MFPDiscovery::serviceName(uint8_t service) {
+    for (int i = 0; i < MFP_SERVICE_COUNT; i++) {
+        if (service & (1 << i)) return serviceNames[i];
+    }
+    return "";
+}
+
+bool MFPDiscovery::due(int index, uint32_t now) const {
+    // Renewed at 80 % of the TTL, before the records from the last query lapse
+    return !queried[index] || now - lastQuery[index] >= ttl / 5 * 4;
+}
+
+bool MFPDiscovery::stale(uint8_t services) const {
+    uint32_t now = millis();
+    for (int i = 0; i < MFP_SERVICE_COUNT; i++) {
+        if ((services & (1 << i)) && due(i, now)) return true;
+    }
+    return false;
+}
+
+void MFPDiscovery::refresh(uint8_t services) {
+    for (int i = 0; i < MFP_SERVICE_COUNT; i++) {
+        if (services & (1 << i)) query(i);
+    }
+}
+
+void MFPDiscovery::refreshStale(uint8_t services) {
+    uint32_t now = millis();
+    for (int i = 0; i < MFP_SERVICE_COUNT; i++) {
+        if ((services & (1 << i)) && due(i, now)) query(i);
+    }
+}
+
+MFPDevice* MFPDiscovery::find(const char* host) {
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(devices[i].host, host) == 0) return &devices[i];
+    }
+    return nullptr;
+}
+
+void MFPDiscovery::query(int index) {
+    xSemaphoreTake(queryLock, portMAX_DELAY);
+    int n = MDNS.queryService(serviceNames[index], "tcp");
+    uint32_t now = millis();
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (int i = 0; i < n; i++) {
+        String host = MDNS.hostname(i);
+        MFPDevice* d = find(host.c_str());
+        if (!d) {
+            if (count >= MFP_MAX_DEVICES) continue;
+            d = &devices[count++];
+            *d = MFPDevice();
+            strncpy(d->host, host.c_str(), sizeof(d->host) - 1);
+        }
+        d->ip = MDNS.address(i);
+        d->services |= 1 << index;
+        d->ports[index] = MDNS.port(i);
+        d->expires[index] = now + ttl;
+    }
+    lastQuery[index] = now;
+    queried[index] = true;
+    queries++;
+    expire(now);
+    xSemaphoreGive(lock);
+    xSemaphoreGive(queryLock);
+}
+
+void MFPDiscovery::expire(uint32_t now) {
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        MFPDevice& d = devices[i];
+        for (int b = 0; b < MFP_SERVICE_COUNT; b++) {
+            if ((d.services & (1 << b)) && (int32_t)(now - d.expires[b]) >= 0) d.services &= ~(1 << b);
+        }
+        if (d.services == 0) continue;
+        if (kept != i) devices[kept] = d;
+        kept++;
+    }
+    count = kept;
+}
+
+size_t MFPDiscovery::getDevices(MFPDevice* out, size_t max, uint8_t services) {
+    size_t n = 0;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    expire(millis());
+    for (size_t i = 0; i < count && n < max; i++) {
+        if (devices[i].services & services) out[n++] = devices[i];
+    }
+    xSemaphoreGive(lock);
+    return n;
+}
+
+void MFPDiscovery::forEach(uint8_t services, const std::function<void(const MFPDevice& device)>& visit) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    expire(millis());
+    for (size_t i = 0; i < count; i++) {
+        if (devices[i].services & services) visit(devices[i]);
+    }
+    xSemaphoreGive(lock);
+}
+
+bool MFPDiscovery::getDevice(const char* address, MFPDevice& device) {
+    bool found = false;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    expire(millis());
+    for (size_t i = 0; i < count && !found; i++) {
+        if (strcmp(devices[i].host, address) == 0 || devices[i].ip.toString() == address) {
+            device = devices[i];
+            found = true;
+        }
+    }
+    xSemaphoreGive(lock);
+    return found;
+}
+
+void MFPDiscovery::clear() {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    count = 0;
+    for (int i = 0; i < MFP_SERVICE_COUNT; i++) queried[i] = false;
+    xSemaphoreGive(lock);
+}
+
+uint32_t MFPDiscovery::getQueryCount() const {
+    return queries;
+}
+
+bool MFPDiscovery::beginBackground(uint8_t services, uint32_t stackSize, UBaseType_t priority) {
+    if (taskAlive) return false;
+    backgroundServices = services;
+    running = true;
+    taskAlive = true;
+    if (xTaskCreate(taskMain, "mfp-discovery", stackSize, this, priority, &task) != pdPASS) {
+        running = false;
+        taskAlive = false;
+        task = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void MFPDiscovery::endBackground() {
+    running = false;
+    while (taskAlive) delay(10);
+    task = nullptr;
+}
+
+bool MFPDiscovery::background() const {
+    return taskAlive;
+}
+
+void MFPDiscovery::taskMain(void* arg) {
+    MFPDiscovery* self = (MFPDiscovery*)arg;
+    while (self->running) {
+        // One service type per pass, so a refresh never holds the mDNS stack for long
+        uint32_t now = millis();
+        for (int i = 0; i < MFP_SERVICE_COUNT; i++) {
+            if ((self->backgroundServices & (1 << i)) && self->due(i, now)) {
+                self->query(i);
+                break;
+            }
+        }
+        vTaskDelay(pdMS_TO_TICKS(250));
+    }
+    self->taskAlive = false;
+    vTaskDelete(nullptr);
+}
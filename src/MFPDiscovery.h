@@ -0,0 +1,107 @@
+#ifndef MFPDiscovery_h
+#define MFPDiscovery_h
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <functional>
+
+#ifndef MFP_MAX_DEVICES
+#define MFP_MAX_DEVICES 16
+#endif
+
+// mDNS service types browsed by discovery, as bits so one device can carry several
+enum MFPService : uint8_t {
+    MFP_SERVICE_IPP      = 0x01,  // _ipp._tcp
+    MFP_SERVICE_USCANNER = 0x02,  // _uscanner._tcp
+    MFP_SERVICE_SCANNER  = 0x04,  // _scanner._tcp
+    MFP_SERVICE_AIRSCAN  = 0x08,  // _airscan._tcp
+    MFP_SERVICE_ESCL     = 0x10,  // _escl._tcp
+    MFP_SERVICE_PRINTERS = MFP_SERVICE_IPP,
+    MFP_SERVICE_SCANNERS = MFP_SERVICE_USCANNER | MFP_SERVICE_SCANNER | MFP_SERVICE_AIRSCAN | MFP_SERVICE_ESCL,
+    MFP_SERVICE_ALL      = MFP_SERVICE_PRINTERS | MFP_SERVICE_SCANNERS
+};
+
+static const int MFP_SERVICE_COUNT = 5;
+
+// One device, merged over all service types it advertises
+struct MFPDevice {
+    char host[64];
+    IPAddress ip;
+    uint8_t services;                      // MFPService bits
+    uint16_t ports[MFP_SERVICE_COUNT];     // per service type, by bit position
+    uint32_t expires[MFP_SERVICE_COUNT];   // millis() at which each record lapses
+
+    uint16_t port(uint8_t service) const;  // port of the first matching service, 0 if none
+};
+
+// Service addresses a device hosts, from its WS-Transfer metadata
+struct MFPServiceEndpoints {
+    char printer[128];
+    char scanner[128];
+};
+
+// Model and service information returned by supported()
+struct MFPDeviceInfo {
+    char uuid[48];        // endpoint address of the device, usually urn:uuid:...
+    char modelName[64];
+    char modelUrl[128];
+    MFPServiceEndpoints services;
+};
+
+// Caches mDNS browse results per device. Every record (device + service type)
+// lives for the TTL after it was last seen, so answers missing from one query
+// do not make a device flicker. Lookups only read the cache; queries run on
+// refresh() or in a background task that renews one service type at a time
+// before its records lapse.
+class MFPDiscovery {
+public:
+    explicit MFPDiscovery(uint32_t ttlMs = 120000);
+    ~MFPDiscovery();
+
+    void setTtl(uint32_t ms);
+    // Queries the given service types now; blocks for one mDNS query per type
+    void refresh(uint8_t services = MFP_SERVICE_ALL);
+    // Queries only the types whose records are missing or about to lapse
+    void refreshStale(uint8_t services = MFP_SERVICE_ALL);
+    bool stale(uint8_t services) const;
+
+    // Keeps the cache fresh from a FreeRTOS task
+    bool beginBackground(uint8_t services = MFP_SERVICE_ALL, uint32_t stackSize = 4096, UBaseType_t priority = 1);
+    void endBackground();
+    bool background() const;
+
+    // Copies devices advertising any of the given services; returns the count
+    size_t getDevices(MFPDevice* out, size_t max, uint8_t services = MFP_SERVICE_ALL);
+    // Visits matching devices in place; the cache is locked during the walk
+    void forEach(uint8_t services, const std::function<void(const MFPDevice& device)>& visit);
+    // Cached device whose host name or IP equals address
+    bool getDevice(const char* address, MFPDevice& device);
+    void clear();
+
+    uint32_t getQueryCount() const;
+    static const char* serviceName(uint8_t service);
+
+private:
+    MFPDevice devices[MFP_MAX_DEVICES];
+    size_t count;
+    uint32_t ttl;
+    uint32_t lastQuery[MFP_SERVICE_COUNT];
+    bool queried[MFP_SERVICE_COUNT];
+    uint32_t queries;
+
+    SemaphoreHandle_t lock;
+    TaskHandle_t task;
+    volatile bool running;
+    volatile bool taskAlive;
+    uint8_t backgroundServices;
+
+    void query(int index);
+    void expire(uint32_t now);
+    MFPDevice* find(const char* host);
+    bool due(int index, uint32_t now) const;
+    static void taskMain(void* arg);
+};
+
+#endif
@@ -0,0 +1,131 @@
+#include "MFPFileWriter.h"
+
+MFPFileWriter::MFPFileWriter() : pool(nullptr), size(0), fill(0), fillLen(0), pending(nullptr), pendingLen(0), total(0),
+                                 error(false), stopping(false), running(false), stallMillis(0) {
+    buffers[0] = buffers[1] = nullptr;
+    ready = xSemaphoreCreateBinary();
+    idle = xSemaphoreCreateBinary();
+}
+
+MFPFileWriter::~MFPFileWriter() {
+    abort();
+    vSemaphoreDelete(ready);
+    vSemaphoreDelete(idle);
+}
+
+bool MFPFileWriter::begin(File output, MFPBufferPool& bufferPool, size_t bufferSize) {
+    if (running || !output) return false;
+    pool = &bufferPool;
+    size_t capacity;
+    buffers[0] = pool->acquire(bufferSize, capacity);
+    buffers[1] = buffers[0] ? pool->acquire(bufferSize, capacity) : nullptr;
+    if (!buffers[1]) {
+        if (buffers[0]) pool->release(buffers[0]);
+        buffers[0] = nullptr;
+        return false;
+    }
+
+    file = output;
+    size = bufferSize;
+    fill = 0;
+    fillLen = 0;
+    total = 0;
+    error = false;
+    stopping = false;
+    stallMillis = 0;
+    // Binary semaphores may still be given from an aborted run
+    xSemaphoreTake(ready, 0);
+    xSemaphoreTake(idle, 0);
+    xSemaphoreGive(idle);
+
+    if (xTaskCreate(taskMain, "mfp-writer", 4096, this, 1, nullptr) != pdPASS) {
+        pool->release(buffers[0]);
+        pool->release(buffers[1]);
+        buffers[0] = buffers[1] = nullptr;
+        return false;
+    }
+    running = true;
+    return true;
+}
+
+bool MFPFileWriter::handOff() {
+    if (fillLen == 0) return !error;
+    unsigned long start = millis();
+    xSemaphoreTake(idle, portMAX_DELAY);
+    stallMillis += millis() - start;
+    if (error) {
+        xSemaphoreGive(idle);
+        return false;
+    }
+    pending = buffers[fill];
+    pendingLen = fillLen;
+    xSemaphoreGive(ready);
+    fill ^= 1;
+    fillLen = 0;
+    return true;
+}
+
+bool MFPFileWriter::write(const uint8_t* data, size_t len) {
+    if (!running || error) return false;
+    while (len > 0) {
+        size_t n = size - fillLen < len ? size - fillLen : len;
+        memcpy(buffers[fill] + fillLen, data, n);
+        fillLen += n;
+        data += n;
+        len -= n;
+        if (fillLen == size && !handOff()) return false;
+    }
+    return true;
+}
+
+void MFPFileWriter::stop(bool flush) {
+    if (!running) return;
+    if (flush) handOff();
+    // Wait for the last buffer, then let the task exit
+    xSemaphoreTake(idle, portMAX_DELAY);
+    stopping = true;
+    xSemaphoreGive(ready);
+    xSemaphoreTake(idle, portMAX_DELAY);
+    running = false;
+
+    file.close();
+    pool->release(buffers[0]);
+    pool->release(buffers[1]);
+    buffers[0] = buffers[1] = nullptr;
+}
+
+bool MFPFileWriter::finish() {
+    if (!running) return false;
+    stop(true);
+    return !error;
+}
+
+void MFPFileWriter::abort() {
+    stop(false);
+}
+
+bool MFPFileWriter::active() const {
+    return running;
+}
+
+size_t MFPFileWriter::written() const {
+    return total;
+}
+
+uint32_t MFPFileWriter::getStallMillis() const {
+    return stallMillis;
+}
+
+void MFPFileWriter::taskMain(void* arg) {
+    MFPFileWriter* self = (MFPFileWriter*)arg;
+    for (;;) {
+        xSemaphoreTake(self->ready, portMAX_DELAY);
+        if (self->stopping) break;
+        size_t n = self->file.write(self->pending, self->pendingLen);
+        self->total += n;
+        if (n != self->pendingLen) self->error = true;
+        xSemaphoreGive(self->idle);
+    }
+    xSemaphoreGive(self->idle);
+    vTaskDelete(nullptr);
+}
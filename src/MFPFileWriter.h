@@ -0,0 +1,58 @@
+#ifndef MFPFileWriter_h
+#define MFPFileWriter_h
+
+#include <Arduino.h>
+#include <FS.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include "MFPBufferPool.h"
+
+#ifndef MFP_FILE_BUFFER_SIZE
+#define MFP_FILE_BUFFER_SIZE 8192
+#endif
+
+// Writes a stream to flash through two alternating buffers: the caller fills
+// one while a FreeRTOS task writes the other, so network reads and flash
+// writes overlap. write() only waits when the flash falls a full buffer behind.
+class MFPFileWriter {
+public:
+    MFPFileWriter();
+    ~MFPFileWriter();
+
+    // Takes ownership of an open file; buffers come from pool
+    bool begin(File file, MFPBufferPool& pool, size_t bufferSize = MFP_FILE_BUFFER_SIZE);
+    bool write(const uint8_t* data, size_t len);
+    // Writes what is left, stops the task and closes the file; false if any write failed
+    bool finish();
+    // Stops without flushing; the file is closed as it is
+    void abort();
+
+    bool active() const;
+    size_t written() const;
+    uint32_t getStallMillis() const;  // time write() spent waiting for the flash
+
+private:
+    File file;
+    MFPBufferPool* pool;
+    uint8_t* buffers[2];
+    size_t size;
+    int fill;                // buffer the caller is filling
+    size_t fillLen;
+    uint8_t* pending;        // buffer handed to the task
+    size_t pendingLen;
+    volatile size_t total;
+    volatile bool error;
+    volatile bool stopping;
+    bool running;
+    uint32_t stallMillis;
+
+    SemaphoreHandle_t ready;  // a buffer is waiting for the task
+    SemaphoreHandle_t idle;   // the task is free for the next buffer
+
+    bool handOff();
+    void stop(bool flush);
+    static void taskMain(void* arg);
+};
+
+#endif
@@ -0,0 +1,362 @@
+#include "MFPHttp.h"
+
+MFPHttpResponse::MFPHttpResponse() {
+    begin();
+}
+
+void MFPHttpResponse::begin() {
+    state = STATUS_LINE;
+    lineLen = 0;
+    statusCode = 0;
+    versionMinor = 1;
+    length = -1;
+    remaining = 0;
+    isChunked = false;
+    isRequest = false;
+    connectionClose = false;
+    connectionKeepAlive = false;
+    type[0] = 0;
+    locationValue[0] = 0;
+}
+
+void MFPHttpResponse::beginRequest() {
+    begin();
+    isRequest = true;
+}
+
+// Collects one line (without CR/LF); returns true once it is complete
+bool MFPHttpResponse::readLine(const uint8_t*& data, size_t& len) {
+    while (len > 0) {
+        char c = (char)*data++;
+        len--;
+        if (c == '\n') {
+            line[lineLen] = 0;
+            return true;
+        }
+        if (c != '\r' && lineLen < maxLine - 1) line[lineLen++] = c;
+    }
+    return false;
+}
+
+bool MFPHttpResponse::statusLine() {
+    if (isRequest) {
+        // METHOD target HTTP/1.x
+        const char* version = strstr(line, " HTTP/1.");
+        if (!version || line[0] == ' ') return false;
+        versionMinor = version[8] - '0';
+        return true;
+    }
+    // HTTP/1.x nnn reason
+    if (strncmp(line, "HTTP/1.", 7) != 0 || lineLen < 12) return false;
+    versionMinor = line[7] - '0';
+    statusCode = atoi(line + 9);
+    return statusCode >= 100;
+}
+
+void MFPHttpResponse::headerLine() {
+    char* colon = strchr(line, ':');
+    if (!colon) return;
+    *colon = 0;
+    const char* value = colon + 1;
+    while (*value == ' ' || *value == '\t') value++;
+
+    if (strcasecmp(line, "Content-Length") == 0) {
+        length = atol(value);
+    } else if (strcasecmp(line, "Transfer-Encoding") == 0) {
+        isChunked = strstr(value, "chunked") != nullptr;
+    } else if (strcasecmp(line, "Connection") == 0) {
+        if (strncasecmp(value, "close", 5) == 0) connectionClose = true;
+        if (strncasecmp(value, "keep-alive", 10) == 0) connectionKeepAlive = true;
+    } else if (strcasecmp(line, "Content-Type") == 0) {
+        strncpy(type, value, maxContentType - 1);
+        type[maxContentType - 1] = 0;
+    } else if (strcasecmp(line, "Location") == 0) {
+        strncpy(locationValue, value, maxLocation - 1);
+        locationValue[maxLocation - 1] = 0;
+    }
+}
+
+void MFPHttpResponse::headersFinished() {
+    if (isRequest) {
+        // A request without Content-Length or chunking has no body
+        if (isChunked) {
+            state = CHUNK_SIZE;
+            remaining = 0;
+        } else {
+            remaining = length > 0 ? length : 0;
+            state = remaining ? BODY : COMPLETE;
+        }
+        return;
+    }
+    if (statusCode < 200) {
+        // Interim response (100 Continue); the real one follows
+        begin();
+        return;
+    }
+    if (statusCode == 204 || statusCode == 304) {
+        state = COMPLETE;
+    } else if (isChunked) {
+        state = CHUNK_SIZE;
+        remaining = 0;
+    } else if (length >= 0) {
+        remaining = length;
+        state = remaining ? BODY : COMPLETE;
+    } else {
+        // Body runs until the connection closes
+        state = BODY;
+    }
+}
+
+bool MFPHttpResponse::feed(const uint8_t* data, size_t len, const HttpBodySink& sink) {
+    while (len > 0) {
+        switch (state) {
+        case STATUS_LINE:
+            if (!readLine(data, len)) return true;
+            if (!statusLine()) {
+                state = FAILED;
+                return false;
+            }
+            lineLen = 0;
+            state = HEADER_LINE;
+            break;
+
+        case HEADER_LINE:
+            if (!readLine(data, len)) return true;
+            if (lineLen == 0) {
+                headersFinished();
+            } else {
+                headerLine();
+            }
+            lineLen = 0;
+            break;
+
+        case BODY: {
+            size_t n = len;
+            if (length >= 0 && n > remaining) n = remaining;
+            if (!sink(data, n)) {
+                state = FAILED;
+                return false;
+            }
+            data += n;
+            len -= n;
+            if (length >= 0) {
+                remaining -= n;
+                if (remaining == 0) state = COMPLETE;
+            }
+            break;
+        }
+
+        case CHUNK_SIZE: {
+            char c = (char)*data++;
+            len--;
+            int digit = -1;
+            if (c >= '0' && c <= '9') digit = c - '0';
+            else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+
+            if (digit >= 0) {
+                remaining = (remaining << 4) | digit;
+            } else if (c == '\n') {
+                state = remaining ? CHUNK_DATA : TRAILER;
+                lineLen = 0;
+            } else if (c != '\r') {
+                // Chunk extensions are ignored
+                state = CHUNK_EXT;
+            }
+            break;
+        }
+
+        case CHUNK_EXT:
+            if (*data++ == '\n') {
+                state = remaining ? CHUNK_DATA : TRAILER;
+                lineLen = 0;
+            }
+            len--;
+            break;
+
+        case CHUNK_DATA: {
+            size_t n = len < remaining ? len : remaining;
+            if (!sink(data, n)) {
+                state = FAILED;
+                return false;
+            }
+            data += n;
+            len -= n;
+            remaining -= n;
+            if (remaining == 0) state = CHUNK_DATA_END;
+            break;
+        }
+
+        case CHUNK_DATA_END:
+            // CRLF after the chunk data
+            if (*data++ == '\n') {
+                state = CHUNK_SIZE;
+                remaining = 0;
+            }
+            len--;
+            break;
+
+        case TRAILER:
+            if (!readLine(data, len)) return true;
+            if (lineLen == 0) state = COMPLETE;
+            lineLen = 0;
+            break;
+
+        case COMPLETE:
+            // Anything after the body belongs to the next response
+            return true;
+
+        case FAILED:
+            return false;
+        }
+    }
+    return true;
+}
+
+void MFPHttpResponse::connectionClosed() {
+    if (state == BODY && length < 0) {
+        state = COMPLETE;
+    } else if (state != COMPLETE) {
+        state = FAILED;
+    }
+}
+
+bool MFPHttpResponse::headersDone() const {
+    return state != STATUS_LINE && state != HEADER_LINE;
+}
+
+bool MFPHttpResponse::complete() const {
+    return state == COMPLETE;
+}
+
+bool MFPHttpResponse::failed() const {
+    return state == FAILED;
+}
+
+int MFPHttpResponse::status() const {
+    return statusCode;
+}
+
+long MFPHttpResponse::contentLength() const {
+    return length;
+}
+
+bool MFPHttpResponse::chunked() const {
+    return isChunked;
+}
+
+bool MFPHttpResponse::keepAlive() const {
+    // HTTP/1.1 defaults to persistent connections, HTTP/1.0 needs an explicit keep-alive
+    if (connectionClose) return false;
+    return versionMinor >= 1 || connectionKeepAlive;
+}
+
+const char* MFPHttpResponse::contentType() const {
+    return type;
+}
+
+String MFPHttpResponse::boundary() const {
+    const char* b = strstr(type, "boundary=");
+    if (!b) return "";
+    b += 9;
+    String result;
+    bool quoted = *b == '"';
+    if (quoted) b++;
+    while (*b && *b != (quoted ? '"' : ';')) result += *b++;
+    result.trim();
+    return result;
+}
+
+const char* MFPHttpResponse::location() const {
+    return locationValue;
+}
+
+MFPConnectionPool::MFPConnectionPool(uint32_t idleTimeoutMs) : idleTimeout(idleTimeoutMs), reuses(0), connects(0) {
+    for (int i = 0; i < maxEntries; i++) {
+        entries[i].host[0] = 0;
+        entries[i].port = 0;
+        entries[i].lastUsed = 0;
+        entries[i].open = false;
+        entries[i].inUse = false;
+    }
+}
+
+void MFPConnectionPool::setIdleTimeout(uint32_t ms) {
+    idleTimeout = ms;
+}
+
+void MFPConnectionPool::close(Entry& entry) {
+    entry.client.stop();
+    entry.open = false;
+    entry.inUse = false;
+}
+
+WiFiClient* MFPConnectionPool::acquire(const char* host, uint16_t port, uint32_t connectTimeout, bool& reused) {
+    evictIdle();
+    reused = false;
+
+    Entry* slot = nullptr;
+    for (int i = 0; i < maxEntries; i++) {
+        Entry& e = entries[i];
+        if (e.inUse) continue;
+        if (e.open && e.port == port && strcmp(e.host, host) == 0) {
+            // Unsolicited data or a closed socket means it cannot be reused
+            if (e.client.connected() && e.client.available() == 0) {
+                e.inUse = true;
+                reused = true;
+                reuses++;
+                return &e.client;
+            }
+            close(e);
+        }
+        // Prefer a free slot, otherwise the least recently used idle one
+        if (!slot || (slot->open && (!e.open || e.lastUsed < slot->lastUsed))) slot = &e;
+    }
+    if (!slot) return nullptr;
+    if (slot->open) close(*slot);
+
+    if (!slot->client.connect(host, port, connectTimeout)) return nullptr;
+    connects++;
+    strncpy(slot->host, host, sizeof(slot->host) - 1);
+    slot->host[sizeof(slot->host) - 1] = 0;
+    slot->port = port;
+    slot->open = true;
+    slot->inUse = true;
+    return &slot->client;
+}
+
+void MFPConnectionPool::release(WiFiClient* client, bool keepAlive) {
+    for (int i = 0; i < maxEntries; i++) {
+        Entry& e = entries[i];
+        if (&e.client != client) continue;
+        if (keepAlive && e.client.connected()) {
+            e.inUse = false;
+            e.lastUsed = millis();
+        } else {
+            close(e);
+        }
+        return;
+    }
+}
+
+void MFPConnectionPool::evictIdle() {
+    unsigned long now = millis();
+    for (int i = 0; i < maxEntries; i++) {
+        Entry& e = entries[i];
+        if (e.open && !e.inUse && now - e.lastUsed > idleTimeout) close(e);
+    }
+}
+
+void MFPConnectionPool::closeAll() {
+    for (int i = 0; i < maxEntries; i++) {
+        if (entries[i].open) close(entries[i]);
+    }
+}
+
+uint32_t MFPConnectionPool::getReuseCount() const {
+    return reuses;
+}
+
+uint32_t MFPConnectionPool::getConnectCount() const {
+    return connects;
+}
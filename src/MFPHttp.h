@@ -0,0 +1,105 @@
+#ifndef MFPHttp_h
+#define MFPHttp_h
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <functional>
+
+// Receives decoded HTTP body data. Return false to abort.
+typedef std::function<bool(const uint8_t* data, size_t len)> HttpBodySink;
+
+// Incremental HTTP/1.1 response parser. Raw socket bytes are fed in blocks;
+// the status line and headers are parsed in place and the body is delivered
+// de-chunked to the sink, so a response is known to be complete as soon as
+// Content-Length bytes or the last chunk have arrived.
+class MFPHttpResponse {
+public:
+    MFPHttpResponse();
+
+    void begin();
+    // Parses a request instead (e.g. an event delivered to the listener); status() stays 0
+    void beginRequest();
+    // Returns false on a malformed response or when the sink aborts
+    bool feed(const uint8_t* data, size_t len, const HttpBodySink& sink);
+    // Tells the parser the peer closed the connection
+    void connectionClosed();
+
+    bool headersDone() const;
+    bool complete() const;
+    bool failed() const;
+
+    int status() const;
+    long contentLength() const;  // -1 if not sent
+    bool chunked() const;
+    bool keepAlive() const;
+    const char* contentType() const;
+    // Value of the boundary parameter of a multipart Content-Type, "" if none
+    String boundary() const;
+    const char* location() const;  // Location header, "" if none
+
+private:
+    enum State { STATUS_LINE, HEADER_LINE, BODY, CHUNK_SIZE, CHUNK_EXT, CHUNK_DATA, CHUNK_DATA_END, TRAILER, COMPLETE, FAILED };
+
+    static const size_t maxLine = 256;
+    static const size_t maxContentType = 160;
+    static const size_t maxLocation = 128;
+
+    State state;
+    char line[maxLine];
+    size_t lineLen;
+
+    int statusCode;
+    int versionMinor;
+    long length;
+    size_t remaining;
+    bool isChunked;
+    bool isRequest;
+    bool connectionClose;
+    bool connectionKeepAlive;
+    char type[maxContentType];
+    char locationValue[maxLocation];
+
+    bool readLine(const uint8_t*& data, size_t& len);
+    bool statusLine();
+    void headerLine();
+    void headersFinished();
+};
+
+// Keeps HTTP connections open between requests to the same host:port so a
+// scan does not pay one TCP handshake per SOAP call. Idle sockets are closed
+// after the idle timeout; sockets the device has closed are dropped on reuse.
+class MFPConnectionPool {
+public:
+    explicit MFPConnectionPool(uint32_t idleTimeoutMs = 15000);
+
+    void setIdleTimeout(uint32_t ms);
+    // Connected client for host:port; reused tells whether it came from the pool
+    WiFiClient* acquire(const char* host, uint16_t port, uint32_t connectTimeout, bool& reused);
+    // Keeps the client for the next request if keepAlive is set, closes it otherwise
+    void release(WiFiClient* client, bool keepAlive);
+    void evictIdle();
+    void closeAll();
+
+    uint32_t getReuseCount() const;
+    uint32_t getConnectCount() const;
+
+private:
+    struct Entry {
+        char host[64];
+        uint16_t port;
+        WiFiClient client;
+        unsigned long lastUsed;
+        bool open;
+        bool inUse;
+    };
+    static const int maxEntries = 4;
+
+    Entry entries[maxEntries];
+    uint32_t idleTimeout;
+    uint32_t reuses;
+    uint32_t connects;
+
+    void close(Entry& entry);
+};
+
+#endif
@@ -0,0 +1,256 @@
+#include "MFPIpp.h"
+
+MFPIppWriter::MFPIppWriter(uint8_t* buffer, size_t size) : buffer(buffer), size(size), used(0), error(false) {
+}
+
+void MFPIppWriter::put(uint8_t b) {
+    if (used >= size) {
+        error = true;
+        return;
+    }
+    buffer[used++] = b;
+}
+
+void MFPIppWriter::put16(uint16_t v) {
+    put(v >> 8);
+    put(v & 0xFF);
+}
+
+void MFPIppWriter::put(const char* s, size_t len) {
+    if (used + len > size) {
+        error = true;
+        return;
+    }
+    memcpy(buffer + used, s, len);
+    used += len;
+}
+
+void MFPIppWriter::name(uint8_t tag, const char* name, size_t valueLength) {
+    size_t len = name ? strlen(name) : 0;
+    put(tag);
+    put16(len);
+    if (len) put(name, len);
+    put16(valueLength);
+}
+
+void MFPIppWriter::begin(uint16_t operation, uint32_t requestId) {
+    used = 0;
+    error = false;
+    put(1);
+    put(1);
+    put16(operation);
+    put16(requestId >> 16);
+    put16(requestId & 0xFFFF);
+    put(MFP_IPP_TAG_OPERATION);
+    // Both must come first, in this order
+    text(MFP_IPP_TAG_CHARSET, "attributes-charset", "utf-8");
+    text(MFP_IPP_TAG_LANGUAGE, "attributes-natural-language", "en");
+}
+
+void MFPIppWriter::text(uint8_t tag, const char* name, const char* value) {
+    size_t len = strlen(value);
+    this->name(tag, name, len);
+    put(value, len);
+}
+
+void MFPIppWriter::integer(uint8_t tag, const char* name, int32_t value) {
+    this->name(tag, name, 4);
+    put16((uint32_t)value >> 16);
+    put16((uint32_t)value & 0xFFFF);
+}
+
+void MFPIppWriter::printerUri(const char* host, int port, const char* path) {
+    char portText[8];
+    snprintf(portText, sizeof(portText), ":%d", port);
+    size_t hostLen = strlen(host);
+    size_t portLen = strlen(portText);
+    size_t pathLen = strlen(path);
+    name(MFP_IPP_TAG_URI, "printer-uri", 6 + hostLen + portLen + pathLen);
+    put("ipp://", 6);
+    put(host, hostLen);
+    put(portText, portLen);
+    put(path, pathLen);
+}
+
+void MFPIppWriter::end() {
+    put(MFP_IPP_TAG_END);
+}
+
+const uint8_t* MFPIppWriter::data() const {
+    return buffer;
+}
+
+size_t MFPIppWriter::length() const {
+    return used;
+}
+
+bool MFPIppWriter::failed() const {
+    return error;
+}
+
+MFPIppResponse::MFPIppResponse() {
+    begin();
+}
+
+void MFPIppResponse::begin() {
+    state = HEADER;
+    field = 0;
+    fieldBytes = 0;
+    nameLength = 0;
+    attribute = OTHER;
+    statusCode = 0xFFFF;
+    job = 0;
+    jobStateValue = MFP_IPP_UNKNOWN;
+    reasons[0] = 0;
+    message[0] = 0;
+}
+
+void MFPIppResponse::attributeName() {
+    // A zero-length name adds a value to the previous attribute; only first values are kept
+    if (nameLength == 0) {
+        attribute = OTHER;
+        return;
+    }
+    nameText[nameLength < maxName ? nameLength : maxName - 1] = 0;
+    if (nameLength >= maxName) attribute = OTHER;
+    else if (strcmp(nameText, "job-id") == 0) attribute = JOB_ID;
+    else if (strcmp(nameText, "job-state") == 0) attribute = JOB_STATE;
+    else if (strcmp(nameText, "job-state-reasons") == 0) attribute = JOB_STATE_REASONS;
+    else if (strcmp(nameText, "status-message") == 0) attribute = STATUS_MESSAGE;
+    else attribute = OTHER;
+}
+
+void MFPIppResponse::attributeValue() {
+    size_t len = valueLength < maxValue ? valueLength : maxValue;
+    switch (attribute) {
+    case JOB_ID:
+        if (len == 4) job = (int32_t)((uint32_t)value[0] << 24 | (uint32_t)value[1] << 16 | value[2] << 8 | value[3]);
+        break;
+    case JOB_STATE:
+        if (len == 4 && value[3] >= MFP_IPP_PENDING && value[3] <= MFP_IPP_COMPLETED) jobStateValue = (MFPIppJobState)value[3];
+        break;
+    case JOB_STATE_REASONS:
+        if (len >= sizeof(reasons)) len = sizeof(reasons) - 1;
+        memcpy(reasons, value, len);
+        reasons[len] = 0;
+        break;
+    case STATUS_MESSAGE:
+        if (len >= sizeof(message)) len = sizeof(message) - 1;
+        memcpy(message, value, len);
+        message[len] = 0;
+        break;
+    default:
+        break;
+    }
+}
+
+bool MFPIppResponse::feed(const uint8_t* data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        uint8_t c = data[i];
+        switch (state) {
+        case HEADER:
+            // version (2), status-code (2), request-id (4)
+            header[fieldBytes++] = c;
+            if (fieldBytes == 8) {
+                statusCode = header[2] << 8 | header[3];
+                fieldBytes = 0;
+                state = TAG;
+            }
+            break;
+
+        case TAG:
+            if (c == MFP_IPP_TAG_END) {
+                state = DONE;
+            } else if (c < 0x10) {
+                // Start of the next attribute group
+            } else {
+                // Value tag; values are told apart by attribute name
+                field = 0;
+                fieldBytes = 0;
+                state = NAME_LENGTH;
+            }
+            break;
+
+        case NAME_LENGTH:
+            field = field << 8 | c;
+            if (++fieldBytes == 2) {
+                nameLength = field;
+                remaining = field;
+                fieldBytes = 0;
+                if (remaining == 0) {
+                    attributeName();
+                    field = 0;
+                    state = VALUE_LENGTH;
+                } else {
+                    state = NAME;
+                }
+            }
+            break;
+
+        case NAME:
+            if (nameLength - remaining < maxName) nameText[nameLength - remaining] = (char)c;
+            if (--remaining == 0) {
+                attributeName();
+                field = 0;
+                state = VALUE_LENGTH;
+            }
+            break;
+
+        case VALUE_LENGTH:
+            field = field << 8 | c;
+            if (++fieldBytes == 2) {
+                valueLength = field;
+                remaining = field;
+                fieldBytes = 0;
+                if (remaining == 0) {
+                    attributeValue();
+                    state = TAG;
+                } else {
+                    state = VALUE;
+                }
+            }
+            break;
+
+        case VALUE:
+            if (valueLength - remaining < maxValue) value[valueLength - remaining] = c;
+            if (--remaining == 0) {
+                attributeValue();
+                state = TAG;
+            }
+            break;
+
+        case DONE:
+            // Document data after the attributes is not used
+            return true;
+        }
+    }
+    return true;
+}
+
+bool MFPIppResponse::complete() const {
+    return state == DONE;
+}
+
+uint16_t MFPIppResponse::status() const {
+    return statusCode;
+}
+
+bool MFPIppResponse::ok() const {
+    return statusCode <= 0x00FF;
+}
+
+int32_t MFPIppResponse::jobId() const {
+    return job;
+}
+
+MFPIppJobState MFPIppResponse::jobState() const {
+    return jobStateValue;
+}
+
+const char* MFPIppResponse::jobStateReasons() const {
+    return reasons;
+}
+
+const char* MFPIppResponse::statusMessage() const {
+    return message;
+}
@@ -0,0 +1,118 @@
+#ifndef MFPIpp_h
+#define MFPIpp_h
+
+#include <Arduino.h>
+
+// IPP operations used by the library (RFC 8011)
+enum MFPIppOperation : uint16_t {
+    MFP_IPP_PRINT_JOB          = 0x0002,
+    MFP_IPP_CANCEL_JOB         = 0x0008,
+    MFP_IPP_GET_JOB_ATTRIBUTES = 0x0009
+};
+
+// Delimiter and value tags
+enum MFPIppTag : uint8_t {
+    MFP_IPP_TAG_OPERATION = 0x01,
+    MFP_IPP_TAG_JOB       = 0x02,
+    MFP_IPP_TAG_END       = 0x03,
+    MFP_IPP_TAG_INTEGER   = 0x21,
+    MFP_IPP_TAG_ENUM      = 0x23,
+    MFP_IPP_TAG_NAME      = 0x42,
+    MFP_IPP_TAG_KEYWORD   = 0x44,
+    MFP_IPP_TAG_URI       = 0x45,
+    MFP_IPP_TAG_CHARSET   = 0x47,
+    MFP_IPP_TAG_LANGUAGE  = 0x48,
+    MFP_IPP_TAG_MIME_TYPE = 0x49
+};
+
+// job-state values; UNKNOWN when the printer could not be asked
+enum MFPIppJobState : uint8_t {
+    MFP_IPP_UNKNOWN    = 0,
+    MFP_IPP_PENDING    = 3,
+    MFP_IPP_HELD       = 4,
+    MFP_IPP_PROCESSING = 5,
+    MFP_IPP_STOPPED    = 6,
+    MFP_IPP_CANCELED   = 7,
+    MFP_IPP_ABORTED    = 8,
+    MFP_IPP_COMPLETED  = 9
+};
+
+// Encodes an IPP request into a caller-provided buffer; nothing is allocated.
+// Writes past the end set failed() instead of overflowing.
+class MFPIppWriter {
+public:
+    MFPIppWriter(uint8_t* buffer, size_t size);
+
+    // Version 1.1 header, then the operation group with charset and language
+    void begin(uint16_t operation, uint32_t requestId);
+    // A nullptr name adds another value to the previous attribute
+    void text(uint8_t tag, const char* name, const char* value);
+    void integer(uint8_t tag, const char* name, int32_t value);
+    // printer-uri as ipp://host:port/path, composed in place
+    void printerUri(const char* host, int port, const char* path);
+    void end();
+
+    const uint8_t* data() const;
+    size_t length() const;
+    bool failed() const;
+
+private:
+    uint8_t* buffer;
+    size_t size;
+    size_t used;
+    bool error;
+
+    void put(uint8_t b);
+    void put16(uint16_t v);
+    void put(const char* s, size_t len);
+    void name(uint8_t tag, const char* name, size_t valueLength);
+};
+
+// Streaming parser for IPP responses. Only the attributes the library uses are
+// kept; everything else is skipped byte by byte, so the size of the response
+// does not matter.
+class MFPIppResponse {
+public:
+    MFPIppResponse();
+
+    void begin();
+    // Takes the body in blocks as it arrives; returns true so it can be an HttpBodySink
+    bool feed(const uint8_t* data, size_t len);
+
+    bool complete() const;            // end-of-attributes seen
+    uint16_t status() const;          // status-code, 0xFFFF until read
+    bool ok() const;                  // successful-ok range
+    int32_t jobId() const;            // 0 if not sent
+    MFPIppJobState jobState() const;
+    const char* jobStateReasons() const;  // first keyword, "" if none
+    const char* statusMessage() const;
+
+private:
+    enum State { HEADER, TAG, NAME_LENGTH, NAME, VALUE_LENGTH, VALUE, DONE };
+    enum Attribute { OTHER, JOB_ID, JOB_STATE, JOB_STATE_REASONS, STATUS_MESSAGE };
+
+    static const size_t maxName = 24;
+    static const size_t maxValue = 64;
+
+    State state;
+    uint8_t header[8];
+    uint16_t field;       // name or value length being read
+    uint8_t fieldBytes;
+    char nameText[maxName];
+    size_t nameLength;
+    Attribute attribute;
+    uint8_t value[maxValue];
+    size_t valueLength;
+    size_t remaining;
+
+    uint16_t statusCode;
+    int32_t job;
+    MFPIppJobState jobStateValue;
+    char reasons[48];
+    char message[64];
+
+    void attributeName();
+    void attributeValue();
+};
+
+#endif
@@ -0,0 +1,99 @@
+#include "MFPJson.h"
+
+size_t MFPJson::string(Print& out, const char* value) {
+    size_t n = out.write('"');
+    const char* run = value;
+    for (const char* p = value; *p; p++) {
+        char c = *p;
+        if (c != '"' && c != '\\' && (uint8_t)c >= 0x20) continue;
+        // Flush the plain run, then the escaped character
+        n += out.write((const uint8_t*)run, p - run);
+        run = p + 1;
+        switch (c) {
+        case '"': n += out.print("\\\""); break;
+        case '\\': n += out.print("\\\\"); break;
+        case '\n': n += out.print("\\n"); break;
+        case '\r': n += out.print("\\r"); break;
+        case '\t': n += out.print("\\t"); break;
+        default: {
+            char hex[7];
+            snprintf(hex, sizeof(hex), "\\u%04x", (uint8_t)c);
+            n += out.print(hex);
+        }
+        }
+    }
+    n += out.write((const uint8_t*)run, strlen(run));
+    n += out.write('"');
+    return n;
+}
+
+size_t MFPJson::device(Print& out, const MFPDevice& d, uint8_t services) {
+    size_t n = out.print("{\"host\":");
+    n += string(out, d.host);
+    n += out.print(",\"ip\":\"");
+    for (int i = 0; i < 4; i++) {
+        if (i > 0) n += out.write('.');
+        n += out.print(d.ip[i]);
+    }
+    n += out.print("\",\"port\":");
+    n += out.print(d.port(services));
+    n += out.print(",\"services\":[");
+    bool first = true;
+    for (int b = 0; b < MFP_SERVICE_COUNT; b++) {
+        if (!(d.services & (1 << b))) continue;
+        if (!first) n += out.write(',');
+        n += string(out, MFPDiscovery::serviceName(1 << b));
+        first = false;
+    }
+    n += out.print("]}");
+    return n;
+}
+
+size_t MFPJson::devices(Print& out, const char* key, const MFPDevice* devices, size_t count, uint8_t services) {
+    size_t n = out.print("{\"");
+    n += out.print(key);
+    n += out.print("\":[");
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) n += out.write(',');
+        n += device(out, devices[i], services);
+    }
+    n += out.print("]}");
+    return n;
+}
+
+size_t MFPJson::devices(Print& out, const char* key, MFPDiscovery& discovery, uint8_t services) {
+    size_t n = out.print("{\"");
+    n += out.print(key);
+    n += out.print("\":[");
+    bool first = true;
+    discovery.forEach(services, [&](const MFPDevice& d) {
+        if (!first) n += out.write(',');
+        n += device(out, d, services);
+        first = false;
+    });
+    n += out.print("]}");
+    return n;
+}
+
+size_t MFPJson::deviceInfo(Print& out, const MFPDeviceInfo& info) {
+    size_t n = out.print("{\"modelName\": ");
+    n += string(out, info.modelName);
+    n += out.print(", \"modelUrl\": ");
+    n += string(out, info.modelUrl);
+    n += out.print(", \"printerService\": ");
+    n += string(out, info.services.printer);
+    n += out.print(", \"scannerService\": ");
+    n += string(out, info.services.scanner);
+    n += out.write('}');
+    return n;
+}
+
+MFPStringPrint::MFPStringPrint(String& target) : target(target) {}
+
+size_t MFPStringPrint::write(uint8_t c) {
+    return target.concat((char)c) ? 1 : 0;
+}
+
+size_t MFPStringPrint::write(const uint8_t* data, size_t len) {
+    return target.concat((const char*)data, len) ? len : 0;
+}
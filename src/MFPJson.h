@@ -0,0 +1,37 @@
+#ifndef MFPJson_h
+#define MFPJson_h
+
+#include <Arduino.h>
+#include "MFPDiscovery.h"
+
+// JSON serializers for the structured results. Output goes straight to a
+// Print (Serial, a File, a WiFiClient...), so no String is built on the way.
+class MFPJson {
+public:
+    // {"scanners":[{"host":..,"ip":..,"port":..,"services":[..]}]}; key is "printers" or "scanners"
+    static size_t devices(Print& out, const char* key, const MFPDevice* devices, size_t count, uint8_t services);
+    // Same, straight from the discovery cache without copying the devices
+    static size_t devices(Print& out, const char* key, MFPDiscovery& discovery, uint8_t services);
+    // {"modelName": .., "modelUrl": .., "printerService": .., "scannerService": ..}
+    static size_t deviceInfo(Print& out, const MFPDeviceInfo& info);
+    // Quoted and escaped string value
+    static size_t string(Print& out, const char* value);
+
+private:
+    static size_t device(Print& out, const MFPDevice& d, uint8_t services);
+};
+
+// Print that appends to a String, for the String-returning wrappers
+class MFPStringPrint : public Print {
+public:
+    explicit MFPStringPrint(String& target);
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* data, size_t len) override;
+    using Print::write;
+
+private:
+    String& target;
+};
+
+#endif
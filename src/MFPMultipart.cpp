@@ -0,0 +1,204 @@
+#include "MFPMultipart.h"
+
+MFPMultipartParser::MFPMultipartParser() {
+    begin("");
+}
+
+void MFPMultipartParser::onImagePart(ImagePartHandler handler) {
+    partHandler = handler;
+}
+
+bool MFPMultipartParser::begin(const String& boundary) {
+    state = BODY;
+    delimLen = 0;
+    carryLen = 0;
+    lineLen = 0;
+    tailDash = false;
+    partIsXml = false;
+    partLength = -1;
+    imagePartLength = -1;
+    deliver = false;
+    imageSeen = false;
+    imageDone = false;
+    delivered = 0;
+
+    if (boundary.length() == 0 || boundary.length() + 4 > maxDelimiter) {
+        state = DONE;
+        return false;
+    }
+
+    // Delimiter is CRLF "--" boundary; the CRLF belongs to the delimiter, not to the part body
+    memcpy(delim, "\r\n--", 4);
+    memcpy(delim + 4, boundary.c_str(), boundary.length());
+    delimLen = boundary.length() + 4;
+
+    // Horspool bad character table
+    for (int i = 0; i < 256; i++) skip[i] = delimLen;
+    for (size_t i = 0; i + 1 < delimLen; i++) skip[delim[i]] = delimLen - 1 - i;
+
+    // The first delimiter may start the body without a leading CRLF
+    carry[0] = '\r';
+    carry[1] = '\n';
+    carryLen = 2;
+    return true;
+}
+
+size_t MFPMultipartParser::search(const uint8_t* data, size_t len) const {
+    const uint8_t last = delim[delimLen - 1];
+    size_t i = 0;
+    while (i + delimLen <= len) {
+        uint8_t c = data[i + delimLen - 1];
+        if (c == last && memcmp(data + i, delim, delimLen - 1) == 0) return i;
+        i += skip[c];
+    }
+    return len;
+}
+
+bool MFPMultipartParser::emit(const uint8_t* data, size_t len, const ScanSink& sink) {
+    if (!deliver || len == 0) return true;
+    delivered += len;
+    return sink(data, len);
+}
+
+void MFPMultipartParser::delimiterFound() {
+    if (deliver) {
+        deliver = false;
+        imageDone = true;
+    }
+    state = DELIMITER_TAIL;
+    tailDash = false;
+}
+
+void MFPMultipartParser::headerLine() {
+    line[lineLen] = 0;
+    if (strncasecmp(line, "Content-Type:", 13) == 0) {
+        partIsXml = strstr(line + 13, "xml") != nullptr;
+    } else if (strncasecmp(line, "Content-Length:", 15) == 0) {
+        partLength = atol(line + 15);
+    }
+    lineLen = 0;
+}
+
+bool MFPMultipartParser::feed(const uint8_t* data, size_t len, const ScanSink& sink) {
+    while (len > 0) {
+        switch (state) {
+        case DONE:
+            // Epilogue is ignored
+            return true;
+
+        case DELIMITER_TAIL: {
+            // Either "--" (closing delimiter) or optional padding up to CRLF
+            uint8_t c = *data++;
+            len--;
+            if (tailDash) {
+                if (c == '-') {
+                    state = DONE;
+                    continue;
+                }
+                tailDash = false;
+            }
+            if (c == '-') {
+                tailDash = true;
+            } else if (c == '\n') {
+                state = HEADERS;
+                lineLen = 0;
+                partIsXml = false;
+                partLength = -1;
+            }
+            break;
+        }
+
+        case HEADERS: {
+            uint8_t c = *data++;
+            len--;
+            if (c == '\r') break;
+            if (c != '\n') {
+                if (lineLen < maxLine - 1) line[lineLen++] = (char)c;
+                break;
+            }
+            if (lineLen > 0) {
+                headerLine();
+                break;
+            }
+            // Blank line: part body follows. Only the first non-XML part is delivered.
+            deliver = !partIsXml && !imageSeen;
+            if (deliver) {
+                imageSeen = true;
+                imagePartLength = partLength;
+                if (partHandler && !partHandler(partLength)) {
+                    state = DONE;
+                    return false;
+                }
+            }
+            state = BODY;
+            break;
+        }
+
+        case BODY: {
+            // Try to complete a delimiter that started in the previous block
+            if (carryLen > 0) {
+                bool resolved = false;
+                for (size_t i = 0; i < carryLen && !resolved; i++) {
+                    size_t have = carryLen - i;
+                    if (memcmp(carry + i, delim, have) != 0) continue;
+                    size_t need = delimLen - have;
+                    if (len >= need) {
+                        if (memcmp(data, delim + have, need) != 0) continue;
+                        if (!emit(carry, i, sink)) return false;
+                        carryLen = 0;
+                        data += need;
+                        len -= need;
+                        delimiterFound();
+                    } else {
+                        if (memcmp(data, delim + have, len) != 0) continue;
+                        // Still only a partial delimiter; keep it for the next block
+                        if (!emit(carry, i, sink)) return false;
+                        memmove(carry, carry + i, have);
+                        memcpy(carry + have, data, len);
+                        carryLen = have + len;
+                        return true;
+                    }
+                    resolved = true;
+                }
+                if (resolved) break;
+                if (!emit(carry, carryLen, sink)) return false;
+                carryLen = 0;
+            }
+
+            size_t pos = search(data, len);
+            if (pos < len) {
+                if (!emit(data, pos, sink)) return false;
+                data += pos + delimLen;
+                len -= pos + delimLen;
+                delimiterFound();
+                break;
+            }
+
+            // Hold back the longest tail that is a prefix of the delimiter
+            size_t keep = len < delimLen - 1 ? len : delimLen - 1;
+            while (keep > 0 && memcmp(data + len - keep, delim, keep) != 0) keep--;
+            if (!emit(data, len - keep, sink)) return false;
+            memcpy(carry, data + len - keep, keep);
+            carryLen = keep;
+            return true;
+        }
+        }
+    }
+    return true;
+}
+
+bool MFPMultipartParser::finished() const {
+    return state == DONE;
+}
+
+bool MFPMultipartParser::imageComplete() const {
+    return imageDone;
+}
+
+size_t MFPMultipartParser::imageBytes() const {
+    return delivered;
+}
+
+long MFPMultipartParser::imageLength() const {
+    return imagePartLength;
+}
@@ -0,0 +1,69 @@
+#ifndef MFPMultipart_h
+#define MFPMultipart_h
+
+#include <Arduino.h>
+#include <functional>
+
+// Size of the blocks read from the socket in one go
+#ifndef MFP_BLOCK_SIZE
+#define MFP_BLOCK_SIZE 1460
+#endif
+
+// Receives scanned image data as it arrives. Return false to abort the transfer.
+typedef std::function<bool(const uint8_t* data, size_t len)> ScanSink;
+// Called when the image part starts; length is its Content-Length or -1 if not sent.
+// Return false to reject the image before any data is read.
+typedef std::function<bool(long length)> ImagePartHandler;
+
+// Incremental multipart/related parser for RetrieveImage responses.
+// Body bytes are fed in blocks of any size; the boundary is located with a
+// Horspool search that also handles delimiters split across block edges.
+// The first non-XML part (the image) is passed to the sink without copying.
+class MFPMultipartParser {
+public:
+    MFPMultipartParser();
+
+    // Boundary as given in the Content-Type header (without the leading "--")
+    bool begin(const String& boundary);
+    void onImagePart(ImagePartHandler handler);
+    // Returns false if the data is malformed or the sink aborted
+    bool feed(const uint8_t* data, size_t len, const ScanSink& sink);
+
+    bool finished() const;       // closing delimiter seen
+    bool imageComplete() const;  // image part was terminated by a delimiter
+    size_t imageBytes() const;
+    long imageLength() const;    // Content-Length of the image part, -1 if unknown
+
+private:
+    enum State { BODY, DELIMITER_TAIL, HEADERS, DONE };
+
+    static const size_t maxDelimiter = 80;  // "\r\n--" + 70 char boundary (RFC 2046) + slack
+    static const size_t maxLine = 128;
+
+    State state;
+    uint8_t delim[maxDelimiter];
+    size_t delimLen;
+    uint8_t skip[256];
+
+    uint8_t carry[maxDelimiter];  // tail of the previous block that may start a delimiter
+    size_t carryLen;
+
+    char line[maxLine];
+    size_t lineLen;
+    bool tailDash;
+    bool partIsXml;
+    long partLength;
+    long imagePartLength;
+    ImagePartHandler partHandler;
+    bool deliver;
+    bool imageSeen;
+    bool imageDone;
+    size_t delivered;
+
+    size_t search(const uint8_t* data, size_t len) const;
+    bool emit(const uint8_t* data, size_t len, const ScanSink& sink);
+    void delimiterFound();
+    void headerLine();
+};
+
+#endif
@@ -0,0 +1,195 @@
+#include "MFPScheduler.h"
+
+template <int... Values>
+MFPLayout<Values...> MFPLayout<Values...>::check() {
+    return MFPLayout();
+}
+template struct MFPLayout<MFP_SCHEDULER_SLOTS, MFP_SCHEDULER_QUEUE, MFP_BLOCK_SIZE, MFP_MAX_STAGES, MFP_MAX_DEVICES, MFP_MAX_CACHED_DEVICES, MFP_POOL_SLOTS>;
+
+MFPScheduler::MFPScheduler(MFPSchedulerLayout) : workerCount(0), nextSeq(0), completed(0), failed(0), running(false) {
+    for (int i = 0; i < MFP_SCHEDULER_SLOTS; i++) {
+        slots[i].busy = false;
+        slots[i].device[0] = 0;
+    }
+    for (int i = 0; i < MFP_SCHEDULER_QUEUE; i++) queue[i].used = false;
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        workers[i].owner = this;
+        workers[i].core = i;
+        workers[i].task = nullptr;
+        workers[i].alive = false;
+    }
+    lock = xSemaphoreCreateMutex();
+}
+
+MFPScheduler::~MFPScheduler() {
+    end();
+    vSemaphoreDelete(lock);
+}
+
+ArduinoMFP& MFPScheduler::instance(int slot) {
+    return mfps[slot];
+}
+
+bool MFPScheduler::begin(uint32_t stackSize, UBaseType_t priority) {
+    if (running) return false;
+    workerCount = portNUM_PROCESSORS < MFP_SCHEDULER_SLOTS ? portNUM_PROCESSORS : MFP_SCHEDULER_SLOTS;
+    running = true;
+    for (int c = 0; c < workerCount; c++) {
+        Worker& w = workers[c];
+        w.alive = true;
+        if (xTaskCreatePinnedToCore(taskMain, "mfp-scheduler", stackSize, &w, priority, &w.task, c) != pdPASS) {
+            Serial.println("Failed to start scheduler task");
+            w.alive = false;
+            w.task = nullptr;
+            end();
+            return false;
+        }
+    }
+    return true;
+}
+
+void MFPScheduler::end() {
+    running = false;
+    for (int c = 0; c < workerCount; c++) {
+        while (workers[c].alive) delay(10);
+        workers[c].task = nullptr;
+    }
+    // Workers are gone, so the slots can be finished from here
+    for (int i = 0; i < MFP_SCHEDULER_SLOTS; i++) {
+        if (!slots[i].busy) continue;
+        mfps[i].cancelJob();
+        finish(i, MFP_JOB_FAILED);
+    }
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (int i = 0; i < MFP_SCHEDULER_QUEUE; i++) {
+        if (!queue[i].used) continue;
+        queue[i].used = false;
+        queue[i].start = nullptr;
+        queue[i].done = nullptr;
+        failed++;
+    }
+    xSemaphoreGive(lock);
+}
+
+bool MFPScheduler::submit(const char* device, MFPJobStart start, MFPJobDone done) {
+    if (!device || !start) return false;
+    bool queued = false;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (int i = 0; i < MFP_SCHEDULER_QUEUE && !queued; i++) {
+        Entry& e = queue[i];
+        if (e.used) continue;
+        e.used = true;
+        e.seq = nextSeq++;
+        strncpy(e.device, device, sizeof(e.device) - 1);
+        e.device[sizeof(e.device) - 1] = 0;
+        e.start = start;
+        e.done = done;
+        queued = true;
+    }
+    xSemaphoreGive(lock);
+    return queued;
+}
+
+bool MFPScheduler::idle() {
+    bool empty = true;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (int i = 0; i < MFP_SCHEDULER_QUEUE && empty; i++) {
+        if (queue[i].used) empty = false;
+    }
+    for (int i = 0; i < MFP_SCHEDULER_SLOTS && empty; i++) {
+        if (slots[i].busy) empty = false;
+    }
+    xSemaphoreGive(lock);
+    return empty;
+}
+
+bool MFPScheduler::waitIdle(uint32_t timeoutMs) {
+    unsigned long start = millis();
+    while (!idle()) {
+        if (millis() - start >= timeoutMs) return false;
+        delay(5);
+    }
+    return true;
+}
+
+uint32_t MFPScheduler::getCompleted() const {
+    return completed;
+}
+
+uint32_t MFPScheduler::getFailed() const {
+    return failed;
+}
+
+bool MFPScheduler::deviceBusy(const char* device) const {
+    for (int i = 0; i < MFP_SCHEDULER_SLOTS; i++) {
+        if (slots[i].busy && strcmp(slots[i].device, device) == 0) return true;
+    }
+    return false;
+}
+
+bool MFPScheduler::take(int slot) {
+    MFPJobStart start;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    // Oldest job whose device is free; sequence numbers keep per-device order
+    Entry* next = nullptr;
+    for (int i = 0; i < MFP_SCHEDULER_QUEUE; i++) {
+        Entry& e = queue[i];
+        if (!e.used || deviceBusy(e.device)) continue;
+        if (!next || (int32_t)(e.seq - next->seq) < 0) next = &e;
+    }
+    if (next) {
+        Slot& s = slots[slot];
+        s.busy = true;
+        strcpy(s.device, next->device);
+        s.done = next->done;
+        start = next->start;
+        next->used = false;
+        next->start = nullptr;
+        next->done = nullptr;
+    }
+    xSemaphoreGive(lock);
+    if (!next) return false;
+
+    if (!start(mfps[slot])) finish(slot, MFP_JOB_FAILED);
+    return true;
+}
+
+void MFPScheduler::finish(int slot, MFPJobState state) {
+    Slot& s = slots[slot];
+    // The device stays busy until done() returns, so its next job cannot overwrite the result
+    if (s.done) s.done(mfps[slot], state);
+    xSemaphoreTake(lock, portMAX_DELAY);
+    s.busy = false;
+    s.done = nullptr;
+    if (state == MFP_JOB_FAILED) failed++;
+    else completed++;
+    xSemaphoreGive(lock);
+}
+
+void MFPScheduler::run(Worker& worker) {
+    while (running) {
+        bool active = false;
+        for (int i = worker.core; i < MFP_SCHEDULER_SLOTS; i += workerCount) {
+            if (!slots[i].busy) {
+                if (take(i)) active = true;
+                continue;
+            }
+            MFPJobState state = mfps[i].poll();
+            if (state == MFP_JOB_RUNNING) {
+                active = true;
+                continue;
+            }
+            // IDLE: start() ran nothing that needs polling
+            finish(i, state == MFP_JOB_IDLE ? MFP_JOB_DONE : state);
+        }
+        // One tick between rounds lets the network stack run; longer when nothing is queued
+        vTaskDelay(active ? 1 : pdMS_TO_TICKS(5));
+    }
+}
+
+void MFPScheduler::taskMain(void* arg) {
+    Worker* worker = (Worker*)arg;
+    worker->owner->run(*worker);
+    worker->alive = false;
+    vTaskDelete(nullptr);
+}
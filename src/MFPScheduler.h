@@ -0,0 +1,96 @@
+#ifndef MFPScheduler_h
+#define MFPScheduler_h
+
+#include "ArduinoMFP.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <functional>
+
+#ifndef MFP_SCHEDULER_SLOTS
+#define MFP_SCHEDULER_SLOTS 4    // jobs running at once, one ArduinoMFP instance each
+#endif
+
+#ifndef MFP_SCHEDULER_QUEUE
+#define MFP_SCHEDULER_QUEUE 16   // jobs waiting for a slot
+#endif
+
+// Checked like MFPBuildLayout: the scheduler holds its instances by value
+typedef MFPLayout<MFP_SCHEDULER_SLOTS, MFP_SCHEDULER_QUEUE, MFP_BLOCK_SIZE, MFP_MAX_STAGES, MFP_MAX_DEVICES, MFP_MAX_CACHED_DEVICES, MFP_POOL_SLOTS> MFPSchedulerLayout;
+
+// Starts a job on the instance it is given, usually with beginScan() or
+// beginPrint(); a blocking call works too. Returns false if nothing was started.
+typedef std::function<bool(ArduinoMFP& mfp)> MFPJobStart;
+// Runs on the worker task when the job has finished
+typedef std::function<void(ArduinoMFP& mfp, MFPJobState state)> MFPJobDone;
+
+// Runs jobs for several devices at once on a fixed set of ArduinoMFP instances.
+// One worker task per core polls the instances it owns (slot i belongs to
+// worker i % cores), so transfers to different devices overlap and their CPU
+// work is spread over both cores. Jobs for the same device run one at a time,
+// in the order they were submitted.
+class MFPScheduler {
+public:
+    MFPScheduler() : MFPScheduler(MFPSchedulerLayout::check()) {}
+    ~MFPScheduler();
+
+    // Configure instances (timeouts, a shared buffer pool...) before begin()
+    ArduinoMFP& instance(int slot);
+    bool begin(uint32_t stackSize = 8192, UBaseType_t priority = 1);
+    // Stops the workers. Running jobs are cancelled and reported as MFP_JOB_FAILED;
+    // queued ones are dropped and counted as failed.
+    void end();
+
+    // device is the host the job talks to; false if the queue is full
+    bool submit(const char* device, MFPJobStart start, MFPJobDone done = nullptr);
+    bool idle();
+    // Waits until all submitted jobs have finished; false on timeout
+    bool waitIdle(uint32_t timeoutMs = UINT32_MAX);
+
+    uint32_t getCompleted() const;
+    uint32_t getFailed() const;
+
+private:
+    explicit MFPScheduler(MFPSchedulerLayout layout);
+
+    struct Entry {
+        bool used;
+        uint32_t seq;
+        char device[64];
+        MFPJobStart start;
+        MFPJobDone done;
+    };
+
+    struct Slot {
+        bool busy;
+        char device[64];
+        MFPJobDone done;
+    };
+
+    struct Worker {
+        MFPScheduler* owner;
+        int core;
+        TaskHandle_t task;
+        volatile bool alive;
+    };
+
+    ArduinoMFP mfps[MFP_SCHEDULER_SLOTS];
+    Slot slots[MFP_SCHEDULER_SLOTS];
+    Entry queue[MFP_SCHEDULER_QUEUE];
+    Worker workers[portNUM_PROCESSORS];
+    int workerCount;
+    uint32_t nextSeq;
+    volatile uint32_t completed;
+    volatile uint32_t failed;
+
+    SemaphoreHandle_t lock;
+    volatile bool running;
+
+    bool deviceBusy(const char* device) const;
+    bool take(int slot);
+    void finish(int slot, MFPJobState state);
+    void run(Worker& worker);
+    static void taskMain(void* arg);
+};
+
+#endif
@@ -0,0 +1,440 @@
+#include "MFPSoap.h"
+
+MFPSoapSlots::MFPSoapSlots() {
+    for (int i = 0; i < SOAP_SLOT_COUNT; i++) {
+        values[i] = "";
+        lengths[i] = 0;
+    }
+}
+
+void MFPSoapSlots::set(uint8_t slot, const char* value) {
+    set(slot, value, value ? strlen(value) : 0);
+}
+
+void MFPSoapSlots::set(uint8_t slot, const char* value, size_t length) {
+    if (slot >= SOAP_SLOT_COUNT) return;
+    values[slot] = value ? value : "";
+    lengths[slot] = value ? length : 0;
+}
+
+void MFPSoapSlots::set(uint8_t slot, const String& value) {
+    set(slot, value.c_str(), value.length());
+}
+
+void MFPSoapSlots::set(uint8_t slot, long number) {
+    if (slot >= SOAP_SLOT_COUNT) return;
+    int n = snprintf(numbers[slot], sizeof(numbers[slot]), "%ld", number);
+    set(slot, numbers[slot], n);
+}
+
+const char* MFPSoapSlots::value(uint8_t slot) const {
+    return slot < SOAP_SLOT_COUNT ? values[slot] : "";
+}
+
+size_t MFPSoapSlots::length(uint8_t slot) const {
+    return slot < SOAP_SLOT_COUNT ? lengths[slot] : 0;
+}
+
+// Slot values come from the caller or from the device (display name, manager
+// address, job token), so markup characters in them are written as entities
+static const char* xmlEntity(char c) {
+    switch (c) {
+    case '&': return "&amp;";
+    case '<': return "&lt;";
+    case '>': return "&gt;";
+    case '"': return "&quot;";
+    default: return nullptr;
+    }
+}
+
+static size_t escapedLength(const char* value, size_t length) {
+    size_t total = length;
+    for (size_t i = 0; i < length; i++) {
+        const char* entity = xmlEntity(value[i]);
+        if (entity) total += strlen(entity) - 1;
+    }
+    return total;
+}
+
+static size_t writeEscaped(Print& out, const char* value, size_t length) {
+    size_t n = 0;
+    size_t run = 0;
+    for (size_t i = 0; i < length; i++) {
+        const char* entity = xmlEntity(value[i]);
+        if (!entity) continue;
+        // Flush the plain run, then the entity
+        n += out.write((const uint8_t*)value + run, i - run);
+        n += out.print(entity);
+        run = i + 1;
+    }
+    n += out.write((const uint8_t*)value + run, length - run);
+    return n;
+}
+
+size_t MFPSoapTemplate::length(const MFPSoapSlots& slots) const {
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        const MFPSoapPart& p = parts[i];
+        total += p.slot == SOAP_TEXT ? p.length : escapedLength(slots.value(p.slot), slots.length(p.slot));
+    }
+    return total;
+}
+
+size_t MFPSoapTemplate::write(Print& out, const MFPSoapSlots& slots) const {
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        const MFPSoapPart& p = parts[i];
+        if (p.slot == SOAP_TEXT) {
+            total += out.write((const uint8_t*)p.text, p.length);
+        } else {
+            total += writeEscaped(out, slots.value(p.slot), slots.length(p.slot));
+        }
+    }
+    return total;
+}
+
+MFPBlockWriter::MFPBlockWriter(Print& out, uint8_t* buffer, size_t size) : out(out), buffer(buffer), size(size), used(0), error(false) {}
+
+MFPBlockWriter::~MFPBlockWriter() {
+    flush();
+}
+
+size_t MFPBlockWriter::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t MFPBlockWriter::write(const uint8_t* data, size_t len) {
+    size_t done = 0;
+    while (done < len && !error) {
+        if (used == size) flush();
+        size_t n = len - done;
+        if (n > size - used) n = size - used;
+        memcpy(buffer + used, data + done, n);
+        used += n;
+        done += n;
+    }
+    return done;
+}
+
+void MFPBlockWriter::flush() {
+    if (used == 0 || error) return;
+    if (out.write(buffer, used) != used) error = true;
+    used = 0;
+}
+
+bool MFPBlockWriter::failed() const {
+    return error;
+}
+
+// --- Templates ---
+
+#define SOAP_ENVELOPE_START \
+    "<?xml version=\"1.0\" encoding=\"utf-8\"?>" \
+    "<soap:Envelope xmlns:soap=\"http://www.w3.org/2003/05/soap-envelope\" " \
+                   "xmlns:wsa=\"http://schemas.xmlsoap.org/ws/2004/08/addressing\" " \
+                   "xmlns:sca=\"http://schemas.microsoft.com/windows/2006/08/wdp/scan\">"
+
+#define SOAP_REPLY_TO \
+    "<wsa:ReplyTo><wsa:Address>http://schemas.xmlsoap.org/ws/2004/08/addressing/role/anonymous</wsa:Address></wsa:ReplyTo>"
+
+// CreateScanJob up to the request element and from the ScanTicket on, shared by
+// the plain and the event-triggered form
+#define CREATE_SCAN_JOB_HEAD \
+    MFP_SOAP_TEXT(SOAP_ENVELOPE_START \
+        "<soap:Header>" \
+        "<wsa:To>http://"), \
+    MFP_SOAP_SLOT(SOAP_HOST), \
+    MFP_SOAP_TEXT("/WebServices/ScannerService</wsa:To>" \
+        "<wsa:Action>http://schemas.microsoft.com/windows/2006/08/wdp/scan/CreateScanJob</wsa:Action>" \
+        "<wsa:MessageID>urn:uuid:"), \
+    MFP_SOAP_SLOT(SOAP_MESSAGE_ID), \
+    MFP_SOAP_TEXT("</wsa:MessageID>" \
+        SOAP_REPLY_TO \
+        "<wsa:From><wsa:Address>urn:uuid:"), \
+    MFP_SOAP_SLOT(SOAP_FROM), \
+    MFP_SOAP_TEXT("</wsa:Address></wsa:From>" \
+        "</soap:Header>" \
+        "<soap:Body>" \
+          "<sca:CreateScanJobRequest>")
+
+#define CREATE_SCAN_JOB_TICKET \
+    MFP_SOAP_TEXT("<sca:ScanTicket>" \
+              "<sca:JobDescription>" \
+                "<sca:JobName>Scan Job</sca:JobName>" \
+                "<sca:JobOriginatingUserName>ESP32</sca:JobOriginatingUserName>" \
+              "</sca:JobDescription>" \
+              "<sca:DocumentParameters>" \
+                "<sca:Format sca:MustHonor=\"true\">"), \
+    MFP_SOAP_SLOT(SOAP_FORMAT), \
+    MFP_SOAP_TEXT("</sca:Format>" \
+                "<sca:InputSource sca:MustHonor=\"true\">"), \
+    MFP_SOAP_SLOT(SOAP_ORIGIN), \
+    MFP_SOAP_TEXT("</sca:InputSource>" \
+                "<sca:MediaSides>" \
+                  "<sca:MediaFront>" \
+                    "<sca:ColorProcessing>RGB24</sca:ColorProcessing>" \
+                    "<sca:Resolution><sca:Width>"), \
+    MFP_SOAP_SLOT(SOAP_WIDTH), \
+    MFP_SOAP_TEXT("</sca:Width><sca:Height>"), \
+    MFP_SOAP_SLOT(SOAP_HEIGHT), \
+    MFP_SOAP_TEXT("</sca:Height></sca:Resolution>" \
+                  "</sca:MediaFront>" \
+                "</sca:MediaSides>" \
+              "</sca:DocumentParameters>" \
+            "</sca:ScanTicket>" \
+          "</sca:CreateScanJobRequest>" \
+        "</soap:Body>" \
+        "</soap:Envelope>")
+
+static const MFPSoapPart createScanJobParts[] = {
+    CREATE_SCAN_JOB_HEAD,
+    CREATE_SCAN_JOB_TICKET
+};
+
+static const MFPSoapPart createEventScanJobParts[] = {
+    CREATE_SCAN_JOB_HEAD,
+    MFP_SOAP_TEXT("<sca:ScanIdentifier>"),
+    MFP_SOAP_SLOT(SOAP_SCAN_IDENTIFIER),
+    MFP_SOAP_TEXT("</sca:ScanIdentifier>"
+            "<sca:DestinationToken>"),
+    MFP_SOAP_SLOT(SOAP_DESTINATION_TOKEN),
+    MFP_SOAP_TEXT("</sca:DestinationToken>"),
+    CREATE_SCAN_JOB_TICKET
+};
+
+static const MFPSoapPart retrieveImageParts[] = {
+    MFP_SOAP_TEXT(SOAP_ENVELOPE_START
+        "<soap:Header>"
+        "<wsa:To>http://"),
+    MFP_SOAP_SLOT(SOAP_HOST),
+    MFP_SOAP_TEXT("/WebServices/ScannerService</wsa:To>"
+        "<wsa:Action>http://schemas.microsoft.com/windows/2006/08/wdp/scan/RetrieveImage</wsa:Action>"
+        "<wsa:MessageID>urn:uuid:"),
+    MFP_SOAP_SLOT(SOAP_MESSAGE_ID),
+    MFP_SOAP_TEXT("</wsa:MessageID>"
+        SOAP_REPLY_TO
+        "<wsa:From><wsa:Address>urn:uuid:"),
+    MFP_SOAP_SLOT(SOAP_FROM),
+    MFP_SOAP_TEXT("</wsa:Address></wsa:From>"
+        "</soap:Header>"
+        "<soap:Body>"
+          "<sca:RetrieveImageRequest>"
+            "<sca:JobId>"),
+    MFP_SOAP_SLOT(SOAP_JOB_ID),
+    MFP_SOAP_TEXT("</sca:JobId>"
+            "<sca:JobToken>"),
+    MFP_SOAP_SLOT(SOAP_JOB_TOKEN),
+    MFP_SOAP_TEXT("</sca:JobToken>"
+            "<sca:DocumentDescription>"
+              "<sca:DocumentName>Scanned image file for the WSD Scan Driver</sca:DocumentName>"
+            "</sca:DocumentDescription>"
+          "</sca:RetrieveImageRequest>"
+        "</soap:Body>"
+        "</soap:Envelope>"),
+};
+
+// Releases a job that will not be retrieved, e.g. a prepared ticket about to lapse
+static const MFPSoapPart cancelJobParts[] = {
+    MFP_SOAP_TEXT(SOAP_ENVELOPE_START
+        "<soap:Header>"
+        "<wsa:To>http://"),
+    MFP_SOAP_SLOT(SOAP_HOST),
+    MFP_SOAP_TEXT("/WebServices/ScannerService</wsa:To>"
+        "<wsa:Action>http://schemas.microsoft.com/windows/2006/08/wdp/scan/CancelJob</wsa:Action>"
+        "<wsa:MessageID>urn:uuid:"),
+    MFP_SOAP_SLOT(SOAP_MESSAGE_ID),
+    MFP_SOAP_TEXT("</wsa:MessageID>"
+        SOAP_REPLY_TO
+        "<wsa:From><wsa:Address>urn:uuid:"),
+    MFP_SOAP_SLOT(SOAP_FROM),
+    MFP_SOAP_TEXT("</wsa:Address></wsa:From>"
+        "</soap:Header>"
+        "<soap:Body>"
+          "<sca:CancelJobRequest>"
+            "<sca:JobId>"),
+    MFP_SOAP_SLOT(SOAP_JOB_ID),
+    MFP_SOAP_TEXT("</sca:JobId>"
+          "</sca:CancelJobRequest>"
+        "</soap:Body>"
+        "</soap:Envelope>"),
+};
+
+static const MFPSoapPart getScannerElementsParts[] = {
+    MFP_SOAP_TEXT(SOAP_ENVELOPE_START
+        "<soap:Header>"
+        "<wsa:To>http://"),
+    MFP_SOAP_SLOT(SOAP_HOST),
+    MFP_SOAP_TEXT("/WebServices/ScannerService</wsa:To>"
+        "<wsa:Action>http://schemas.microsoft.com/windows/2006/08/wdp/scan/GetScannerElements</wsa:Action>"
+        "<wsa:MessageID>urn:uuid:"),
+    MFP_SOAP_SLOT(SOAP_MESSAGE_ID),
+    MFP_SOAP_TEXT("</wsa:MessageID>"
+        SOAP_REPLY_TO
+        "</soap:Header>"
+        "<soap:Body>"
+          "<sca:GetScannerElementsRequest>"
+            "<sca:RequestedElements>"
+              "<sca:Name>sca:ScannerConfiguration</sca:Name>"
+            "</sca:RequestedElements>"
+          "</sca:GetScannerElementsRequest>"
+        "</soap:Body>"
+        "</soap:Envelope>"),
+};
+
+static const MFPSoapPart getMetadataParts[] = {
+    MFP_SOAP_TEXT("<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+        "<soap:Envelope xmlns:soap=\"http://www.w3.org/2003/05/soap-envelope\""
+        " xmlns:wsa=\"http://schemas.xmlsoap.org/ws/2004/08/addressing\""
+        " xmlns:wxf=\"http://schemas.xmlsoap.org/ws/2004/09/transfer\""
+        " xmlns:wsd=\"http://schemas.xmlsoap.org/ws/2005/04/discovery\">"
+        "<soap:Header>"
+        "<wsa:To>http://"),
+    MFP_SOAP_SLOT(SOAP_HOST),
+    MFP_SOAP_TEXT(":"),
+    MFP_SOAP_SLOT(SOAP_PORT),
+    MFP_SOAP_TEXT("/WebServices/Device</wsa:To>"
+        "<wsa:Action>http://schemas.xmlsoap.org/ws/2004/09/transfer/Get</wsa:Action>"
+        "<wsa:MessageID>urn:uuid:"),
+    MFP_SOAP_SLOT(SOAP_MESSAGE_ID),
+    MFP_SOAP_TEXT("</wsa:MessageID>"
+        "</soap:Header>"
+        "<soap:Body />"
+        "</soap:Envelope>"),
+};
+
+#define SOAP_EVENTING_ENVELOPE_START \
+    "<?xml version=\"1.0\" encoding=\"utf-8\"?>" \
+    "<soap:Envelope xmlns:soap=\"http://www.w3.org/2003/05/soap-envelope\" " \
+                   "xmlns:wsa=\"http://schemas.xmlsoap.org/ws/2004/08/addressing\" " \
+                   "xmlns:wse=\"http://schemas.xmlsoap.org/ws/2004/08/eventing\" " \
+                   "xmlns:sca=\"http://schemas.microsoft.com/windows/2006/08/wdp/scan\">"
+
+// Registers the listener as a scan destination shown on the device panel
+static const MFPSoapPart subscribeParts[] = {
+    MFP_SOAP_TEXT(SOAP_EVENTING_ENVELOPE_START
+        "<soap:Header>"
+        "<wsa:To>http://"),
+    MFP_SOAP_SLOT(SOAP_HOST),
+    MFP_SOAP_TEXT("/WebServices/ScannerService</wsa:To>"
+        "<wsa:Action>http://schemas.xmlsoap.org/ws/2004/08/eventing/Subscribe</wsa:Action>"
+        "<wsa:MessageID>urn:uuid:"),
+    MFP_SOAP_SLOT(SOAP_MESSAGE_ID),
+    MFP_SOAP_TEXT("</wsa:MessageID>"
+        SOAP_REPLY_TO
+        "<wsa:From><wsa:Address>urn:uuid:"),
+    MFP_SOAP_SLOT(SOAP_FROM),
+    MFP_SOAP_TEXT("</wsa:Address></wsa:From>"
+        "</soap:Header>"
+        "<soap:Body>"
+          "<wse:Subscribe>"
+            "<wse:Delivery Mode=\"http://schemas.xmlsoap.org/ws/2004/08/eventing/DeliveryModes/Push\">"
+              "<wse:NotifyTo><wsa:Address>"),
+    MFP_SOAP_SLOT(SOAP_ADDRESS),
+    MFP_SOAP_TEXT("</wsa:Address>"
+                "<wsa:ReferenceParameters><wse:Identifier>urn:uuid:"),
+    MFP_SOAP_SLOT(SOAP_IDENTIFIER),
+    MFP_SOAP_TEXT("</wse:Identifier></wsa:ReferenceParameters>"
+              "</wse:NotifyTo>"
+            "</wse:Delivery>"
+            "<wse:Expires>PT"),
+    MFP_SOAP_SLOT(SOAP_EXPIRES),
+    MFP_SOAP_TEXT("S</wse:Expires>"
+            "<wse:Filter Dialect=\"http://schemas.xmlsoap.org/ws/2006/02/devprof/Action\">"
+              "http://schemas.microsoft.com/windows/2006/08/wdp/scan/ScanAvailableEvent"
+            "</wse:Filter>"
+            "<sca:ScanDestinations><sca:ScanDestination>"
+              "<sca:ClientDisplayName>"),
+    MFP_SOAP_SLOT(SOAP_DISPLAY_NAME),
+    MFP_SOAP_TEXT("</sca:ClientDisplayName>"
+              "<sca:ClientContext>Scan</sca:ClientContext>"
+            "</sca:ScanDestination></sca:ScanDestinations>"
+          "</wse:Subscribe>"
+        "</soap:Body>"
+        "</soap:Envelope>"),
+};
+
+// Renew and Unsubscribe go to the subscription manager and carry its identifier
+static const MFPSoapPart renewParts[] = {
+    MFP_SOAP_TEXT(SOAP_EVENTING_ENVELOPE_START
+        "<soap:Header>"
+        "<wsa:To>"),
+    MFP_SOAP_SLOT(SOAP_ADDRESS),
+    MFP_SOAP_TEXT("</wsa:To>"
+        "<wsa:Action>http://schemas.xmlsoap.org/ws/2004/08/eventing/Renew</wsa:Action>"
+        "<wsa:MessageID>urn:uuid:"),
+    MFP_SOAP_SLOT(SOAP_MESSAGE_ID),
+    MFP_SOAP_TEXT("</wsa:MessageID>"
+        SOAP_REPLY_TO
+        "<wse:Identifier>"),
+    MFP_SOAP_SLOT(SOAP_IDENTIFIER),
+    MFP_SOAP_TEXT("</wse:Identifier>"
+        "</soap:Header>"
+        "<soap:Body>"
+          "<wse:Renew><wse:Expires>PT"),
+    MFP_SOAP_SLOT(SOAP_EXPIRES),
+    MFP_SOAP_TEXT("S</wse:Expires></wse:Renew>"
+        "</soap:Body>"
+        "</soap:Envelope>"),
+};
+
+static const MFPSoapPart unsubscribeParts[] = {
+    MFP_SOAP_TEXT(SOAP_EVENTING_ENVELOPE_START
+        "<soap:Header>"
+        "<wsa:To>"),
+    MFP_SOAP_SLOT(SOAP_ADDRESS),
+    MFP_SOAP_TEXT("</wsa:To>"
+        "<wsa:Action>http://schemas.xmlsoap.org/ws/2004/08/eventing/Unsubscribe</wsa:Action>"
+        "<wsa:MessageID>urn:uuid:"),
+    MFP_SOAP_SLOT(SOAP_MESSAGE_ID),
+    MFP_SOAP_TEXT("</wsa:MessageID>"
+        SOAP_REPLY_TO
+        "<wse:Identifier>"),
+    MFP_SOAP_SLOT(SOAP_IDENTIFIER),
+    MFP_SOAP_TEXT("</wse:Identifier>"
+        "</soap:Header>"
+        "<soap:Body>"
+          "<wse:Unsubscribe/>"
+        "</soap:Body>"
+        "</soap:Envelope>"),
+};
+
+// eSCL ScanSettings; format is a MIME type, origin Platen or Feeder, width/height the resolution
+static const MFPSoapPart esclScanSettingsParts[] = {
+    MFP_SOAP_TEXT("<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+        "<scan:ScanSettings xmlns:scan=\"http://schemas.hp.com/imaging/escl/2011/05/03\""
+        " xmlns:pwg=\"http://www.pwg.org/schemas/2010/12/sm\">"
+        "<pwg:Version>2.0</pwg:Version>"
+        "<pwg:InputSource>"),
+    MFP_SOAP_SLOT(SOAP_ORIGIN),
+    MFP_SOAP_TEXT("</pwg:InputSource>"
+        "<scan:Duplex>"),
+    MFP_SOAP_SLOT(SOAP_DUPLEX),
+    MFP_SOAP_TEXT("</scan:Duplex>"
+        "<scan:ColorMode>RGB24</scan:ColorMode>"
+        "<pwg:DocumentFormat>"),
+    MFP_SOAP_SLOT(SOAP_FORMAT),
+    MFP_SOAP_TEXT("</pwg:DocumentFormat>"
+        "<scan:DocumentFormatExt>"),
+    MFP_SOAP_SLOT(SOAP_FORMAT),
+    MFP_SOAP_TEXT("</scan:DocumentFormatExt>"
+        "<scan:XResolution>"),
+    MFP_SOAP_SLOT(SOAP_WIDTH),
+    MFP_SOAP_TEXT("</scan:XResolution>"
+        "<scan:YResolution>"),
+    MFP_SOAP_SLOT(SOAP_HEIGHT),
+    MFP_SOAP_TEXT("</scan:YResolution>"
+        "</scan:ScanSettings>"),
+};
+
+#define MFP_SOAP_TEMPLATE(parts) MFPSoapTemplate(parts, sizeof(parts) / sizeof(parts[0]))
+
+const MFPSoapTemplate MFPCreateScanJobSoap = MFP_SOAP_TEMPLATE(createScanJobParts);
+const MFPSoapTemplate MFPCreateEventScanJobSoap = MFP_SOAP_TEMPLATE(createEventScanJobParts);
+const MFPSoapTemplate MFPRetrieveImageSoap = MFP_SOAP_TEMPLATE(retrieveImageParts);
+const MFPSoapTemplate MFPCancelJobSoap = MFP_SOAP_TEMPLATE(cancelJobParts);
+const MFPSoapTemplate MFPGetScannerElementsSoap = MFP_SOAP_TEMPLATE(getScannerElementsParts);
+const MFPSoapTemplate MFPGetMetadataSoap = MFP_SOAP_TEMPLATE(getMetadataParts);
+const MFPSoapTemplate MFPSubscribeSoap = MFP_SOAP_TEMPLATE(subscribeParts);
+const MFPSoapTemplate MFPRenewSoap = MFP_SOAP_TEMPLATE(renewParts);
+const MFPSoapTemplate MFPUnsubscribeSoap = MFP_SOAP_TEMPLATE(unsubscribeParts);
+const MFPSoapTemplate MFPEsclScanSettings = MFP_SOAP_TEMPLATE(esclScanSettingsParts);
@@ -0,0 +1,108 @@
+#ifndef MFPSoap_h
+#define MFPSoap_h
+
+#include <Arduino.h>
+
+// Values that can be filled into a SOAP template
+enum MFPSoapSlot {
+    SOAP_HOST,        // device address used in wsa:To
+    SOAP_PORT,
+    SOAP_MESSAGE_ID,
+    SOAP_FROM,        // client UUID
+    SOAP_FORMAT,
+    SOAP_ORIGIN,
+    SOAP_WIDTH,
+    SOAP_HEIGHT,
+    SOAP_JOB_ID,
+    SOAP_JOB_TOKEN,
+    SOAP_DUPLEX,      // eSCL: "true" / "false"
+    SOAP_ADDRESS,     // WS-Eventing: NotifyTo in Subscribe, the subscription manager in Renew/Unsubscribe
+    SOAP_IDENTIFIER,  // WS-Eventing: subscription identifier
+    SOAP_EXPIRES,     // WS-Eventing: seconds requested
+    SOAP_DISPLAY_NAME,
+    SOAP_SCAN_IDENTIFIER,
+    SOAP_DESTINATION_TOKEN,
+    SOAP_SLOT_COUNT,
+    SOAP_TEXT = 0xFF  // part is literal text
+};
+
+// One piece of a template: literal text (length known at compile time) or a slot
+struct MFPSoapPart {
+    const char* text;
+    uint16_t length;
+    uint8_t slot;
+};
+
+#define MFP_SOAP_TEXT(s) { s, sizeof(s) - 1, SOAP_TEXT }
+#define MFP_SOAP_SLOT(id) { nullptr, 0, id }
+
+// Slot values for one rendering. Only pointers are stored; numbers are
+// formatted into a small inline buffer, so filling slots never allocates.
+class MFPSoapSlots {
+public:
+    MFPSoapSlots();
+
+    void set(uint8_t slot, const char* value);
+    void set(uint8_t slot, const char* value, size_t length);
+    void set(uint8_t slot, const String& value);
+    void set(uint8_t slot, long number);
+
+    const char* value(uint8_t slot) const;
+    size_t length(uint8_t slot) const;
+
+private:
+    const char* values[SOAP_SLOT_COUNT];
+    uint16_t lengths[SOAP_SLOT_COUNT];
+    char numbers[SOAP_SLOT_COUNT][12];
+};
+
+// A SOAP envelope as a constant list of parts kept in flash. Slot values are
+// XML-escaped when rendered.
+class MFPSoapTemplate {
+public:
+    constexpr MFPSoapTemplate(const MFPSoapPart* parts, size_t count) : parts(parts), count(count) {}
+
+    // Rendered size, e.g. for Content-Length, without rendering
+    size_t length(const MFPSoapSlots& slots) const;
+    size_t write(Print& out, const MFPSoapSlots& slots) const;
+
+private:
+    const MFPSoapPart* parts;
+    size_t count;
+};
+
+// Collects small writes into a block and passes it on in one write, so a
+// rendered request leaves in MTU-sized segments instead of one per part
+class MFPBlockWriter : public Print {
+public:
+    MFPBlockWriter(Print& out, uint8_t* buffer, size_t size);
+    ~MFPBlockWriter();
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* data, size_t len) override;
+    using Print::write;
+    void flush() override;
+    bool failed() const;
+
+private:
+    Print& out;
+    uint8_t* buffer;
+    size_t size;
+    size_t used;
+    bool error;
+};
+
+extern const MFPSoapTemplate MFPCreateScanJobSoap;
+// CreateScanJob answering a ScanAvailableEvent (scan started at the device panel)
+extern const MFPSoapTemplate MFPCreateEventScanJobSoap;
+extern const MFPSoapTemplate MFPRetrieveImageSoap;
+extern const MFPSoapTemplate MFPCancelJobSoap;
+extern const MFPSoapTemplate MFPGetScannerElementsSoap;
+extern const MFPSoapTemplate MFPGetMetadataSoap;
+extern const MFPSoapTemplate MFPSubscribeSoap;
+extern const MFPSoapTemplate MFPRenewSoap;
+extern const MFPSoapTemplate MFPUnsubscribeSoap;
+// Not SOAP: the eSCL ScanSettings document, rendered the same way
+extern const MFPSoapTemplate MFPEsclScanSettings;
+
+#endif
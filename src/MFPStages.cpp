@@ -0,0 +1,769 @@
+#include "MFPStages.h"
+#include <esp_rom_crc.h>
+
+MFPCrc32::MFPCrc32() : crc(0), complete(false) {}
+
+void MFPCrc32::begin() {
+    crc = 0;
+    complete = false;
+}
+
+void MFPCrc32::feed(const uint8_t* data, size_t len) {
+    // The ROM routine inverts before and after, so results chain across blocks
+    crc = esp_rom_crc32_le(crc, data, len);
+}
+
+void MFPCrc32::end() {
+    complete = true;
+}
+
+bool MFPCrc32::ready() const {
+    return complete;
+}
+
+uint32_t MFPCrc32::value() const {
+    return crc;
+}
+
+MFPSha256::MFPSha256() : complete(false) {
+    mbedtls_sha256_init(&context);
+    memset(hash, 0, sizeof(hash));
+}
+
+MFPSha256::~MFPSha256() {
+    mbedtls_sha256_free(&context);
+}
+
+void MFPSha256::begin() {
+    complete = false;
+    mbedtls_sha256_starts(&context, 0);
+}
+
+void MFPSha256::feed(const uint8_t* data, size_t len) {
+    mbedtls_sha256_update(&context, data, len);
+}
+
+void MFPSha256::end() {
+    mbedtls_sha256_finish(&context, hash);
+    complete = true;
+}
+
+bool MFPSha256::ready() const {
+    return complete;
+}
+
+const uint8_t* MFPSha256::digest() const {
+    return hash;
+}
+
+void MFPSha256::hex(char* out) const {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < 32; i++) {
+        out[i * 2] = digits[hash[i] >> 4];
+        out[i * 2 + 1] = digits[hash[i] & 15];
+    }
+    out[64] = 0;
+}
+
+// Markers that start a frame: SOF0-SOF15 without DHT (C4), JPG (C8) and DAC (CC)
+static bool isFrameMarker(uint8_t m) {
+    return m >= 0xC0 && m <= 0xCF && m != 0xC4 && m != 0xC8 && m != 0xCC;
+}
+
+// RSTn, TEM and SOI carry no length
+static bool isStandalone(uint8_t m) {
+    return (m >= 0xD0 && m <= 0xD8) || m == 0x01;
+}
+
+MFPJpegProbe::MFPJpegProbe() {
+    begin();
+}
+
+void MFPJpegProbe::begin() {
+    state = SOI_FF;
+    marker = 0;
+    remaining = 0;
+    offset = 0;
+    memset(frame, 0, sizeof(frame));
+    total = 0;
+    found = false;
+    isProgressive = false;
+}
+
+void MFPJpegProbe::feed(const uint8_t* data, size_t len) {
+    total += len;
+    size_t i = 0;
+    while (i < len && state != DONE && state != INVALID) {
+        if (state == SEGMENT && !isFrameMarker(marker)) {
+            // Other segments (EXIF, tables...) are skipped in one step
+            size_t n = len - i < remaining ? len - i : remaining;
+            i += n;
+            remaining -= n;
+            if (remaining == 0) state = MARKER_FF;
+            continue;
+        }
+        uint8_t b = data[i++];
+        switch (state) {
+        case SOI_FF:
+            state = b == 0xFF ? SOI_D8 : INVALID;
+            break;
+        case SOI_D8:
+            state = b == 0xD8 ? MARKER_FF : INVALID;
+            break;
+        case MARKER_FF:
+            state = b == 0xFF ? MARKER : INVALID;
+            break;
+        case MARKER:
+            if (b == 0xFF) break;  // fill byte
+            marker = b;
+            // Entropy data or the end before any frame header: not a usable JPEG
+            if (b == 0xDA || b == 0xD9) state = INVALID;
+            else state = isStandalone(b) ? MARKER_FF : LENGTH_HIGH;
+            break;
+        case LENGTH_HIGH:
+            remaining = b << 8;
+            state = LENGTH_LOW;
+            break;
+        case LENGTH_LOW:
+            remaining |= b;
+            if (remaining < 2 || (isFrameMarker(marker) && remaining < 8)) {
+                state = INVALID;
+                break;
+            }
+            remaining -= 2;
+            offset = 0;
+            state = remaining ? SEGMENT : MARKER_FF;
+            break;
+        case SEGMENT:
+            // Frame header: precision, height, width, components
+            frame[offset++] = b;
+            remaining--;
+            if (offset == sizeof(frame)) {
+                found = true;
+                isProgressive = marker == 0xC2 || marker == 0xC6 || marker == 0xCA || marker == 0xCE;
+                state = DONE;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void MFPJpegProbe::end() {}
+
+bool MFPJpegProbe::ready() const {
+    return found;
+}
+
+uint16_t MFPJpegProbe::width() const {
+    return (frame[3] << 8) | frame[4];
+}
+
+uint16_t MFPJpegProbe::height() const {
+    return (frame[1] << 8) | frame[2];
+}
+
+uint8_t MFPJpegProbe::components() const {
+    return frame[5];
+}
+
+bool MFPJpegProbe::progressive() const {
+    return isProgressive;
+}
+
+size_t MFPJpegProbe::bytes() const {
+    return total;
+}
+
+// DQT, DHT, SOF and SOS segments are read whole; 1 KB holds the largest an 8-bit JPEG needs
+static const size_t maxSegment = 1024;
+// Thumbnail rows that can be in progress at once; one MCU row spans up to 4 block rows
+static const int sumRows = 4;
+
+struct MFPJpegThumbnail::Decoder {
+    enum State { SOI_FF, SOI_D8, MARKER_FF, MARKER, LENGTH_HIGH, LENGTH_LOW, SEGMENT, SKIP, SKIP_SCAN, ENTROPY, DONE, FAILED };
+
+    struct Huffman {
+        bool defined;
+        uint16_t look[256];     // (length << 8) | symbol for codes up to 8 bits, 0 if longer
+        int32_t maxCode[17];    // largest code of each length, -1 if none
+        int32_t valOffset[17];  // symbol index minus code, per length
+        uint8_t values[256];
+    };
+
+    struct Component {
+        uint8_t id;
+        uint8_t h;
+        uint8_t v;
+        uint8_t quant;
+        uint8_t dcTable;
+        uint8_t acTable;
+        int32_t pred;
+        uint32_t blocksW;   // blocks that carry image data
+        uint32_t blocksH;
+    };
+
+    State state;
+    uint8_t marker;
+    uint16_t remaining;
+    uint16_t segmentLength;
+    uint8_t segment[maxSegment];
+
+    bool haveFrame;
+    bool progressive;
+    uint16_t width;
+    uint16_t height;
+    uint8_t componentCount;
+    Component components[4];
+    uint8_t hMax;
+    uint8_t vMax;
+    uint16_t quant[4];     // DC entry of each quantization table
+    bool quantDefined[4];
+    Huffman tables[4];     // DC 0, DC 1, AC 0, AC 1
+    uint16_t restartInterval;
+
+    // Current scan
+    uint8_t ss;
+    uint8_t se;
+    uint8_t al;
+    bool interleaved;
+    uint8_t mcuComponent[10];  // component of each block in the MCU
+    uint8_t mcuSub[10];        // position of the block inside its component's H x V group
+    uint8_t mcuBlockCount;
+    uint32_t mcusX;
+    uint32_t mcuTotal;
+    uint32_t mcu;
+    uint8_t blockIndex;
+    uint8_t k;              // next coefficient of the block, 0 = DC
+    int16_t symbol;         // decoded, waiting for its extra bits; -1 if none
+    uint16_t restartLeft;
+    bool syncing;           // restart interval over, looking for its RST marker
+
+    // Bit reader; bits are kept MSB first in acc
+    uint32_t acc;
+    uint8_t bits;
+    uint8_t overrun;        // bits consumed past a marker, padded with zeros
+    bool markerHit;
+    uint8_t markerCode;
+    bool pendingFF;
+
+    uint32_t* sums;         // sumRows rows of the thumbnail being accumulated
+    uint32_t flushedRows;
+};
+
+MFPJpegThumbnail::MFPJpegThumbnail(uint16_t maxWidth, uint16_t maxHeight) : maxWidth(maxWidth ? maxWidth : 1), maxHeight(maxHeight ? maxHeight : 1),
+    thumbWidth(0), thumbHeight(0), factor(1), thumb(nullptr), thumbCapacity(0), complete(false), decoder(nullptr) {}
+
+MFPJpegThumbnail::~MFPJpegThumbnail() {
+    release();
+    free(thumb);
+}
+
+void MFPJpegThumbnail::release() {
+    if (!decoder) return;
+    free(decoder->sums);
+    free(decoder);
+    decoder = nullptr;
+}
+
+void MFPJpegThumbnail::begin() {
+    release();
+    complete = false;
+    thumbWidth = 0;
+    thumbHeight = 0;
+    decoder = (Decoder*)calloc(1, sizeof(Decoder));
+    if (!decoder) Serial.println("Not enough memory for the thumbnail decoder");
+}
+
+void MFPJpegThumbnail::end() {
+    // Only a fully decoded luma scan counts; the decoder is freed either way
+    complete = decoder && decoder->state == Decoder::DONE && decoder->flushedRows == thumbHeight && thumbHeight > 0;
+    release();
+}
+
+bool MFPJpegThumbnail::ready() const {
+    return complete;
+}
+
+uint16_t MFPJpegThumbnail::width() const {
+    return complete ? thumbWidth : 0;
+}
+
+uint16_t MFPJpegThumbnail::height() const {
+    return complete ? thumbHeight : 0;
+}
+
+const uint8_t* MFPJpegThumbnail::pixels() const {
+    return complete ? thumb : nullptr;
+}
+
+uint8_t MFPJpegThumbnail::scale() const {
+    return factor;
+}
+
+void MFPJpegThumbnail::feed(const uint8_t* data, size_t len) {
+    if (!decoder) return;
+    Decoder& d = *decoder;
+    size_t i = 0;
+    while (i < len && d.state != Decoder::DONE && d.state != Decoder::FAILED) {
+        if (d.state == Decoder::ENTROPY) {
+            i += entropy(d, data + i, len - i);
+            continue;
+        }
+        if (d.state == Decoder::SKIP) {
+            size_t n = len - i < d.remaining ? len - i : d.remaining;
+            i += n;
+            d.remaining -= n;
+            if (d.remaining == 0) d.state = Decoder::MARKER_FF;
+            continue;
+        }
+        uint8_t b = data[i++];
+        switch (d.state) {
+        case Decoder::SOI_FF:
+            d.state = b == 0xFF ? Decoder::SOI_D8 : Decoder::FAILED;
+            break;
+        case Decoder::SOI_D8:
+            d.state = b == 0xD8 ? Decoder::MARKER_FF : Decoder::FAILED;
+            break;
+        case Decoder::MARKER_FF:
+            d.state = b == 0xFF ? Decoder::MARKER : Decoder::FAILED;
+            break;
+        case Decoder::MARKER:
+            if (b != 0xFF) marker(d, b);
+            break;
+        case Decoder::LENGTH_HIGH:
+            d.remaining = b << 8;
+            d.state = Decoder::LENGTH_LOW;
+            break;
+        case Decoder::LENGTH_LOW: {
+            d.remaining |= b;
+            if (d.remaining < 2) {
+                d.state = Decoder::FAILED;
+                break;
+            }
+            d.remaining -= 2;
+            d.segmentLength = d.remaining;
+            uint8_t m = d.marker;
+            if (isFrameMarker(m) && m != 0xC0 && m != 0xC1 && m != 0xC2) {
+                // Lossless, hierarchical and arithmetic-coded frames
+                d.state = Decoder::FAILED;
+            } else if (isFrameMarker(m) || m == 0xC4 || m == 0xDB || m == 0xDD || m == 0xDA) {
+                if (d.remaining > maxSegment) d.state = Decoder::FAILED;
+                else if (d.remaining == 0) d.state = header(d) ? d.state : Decoder::FAILED;
+                else d.state = Decoder::SEGMENT;
+            } else {
+                d.state = d.remaining ? Decoder::SKIP : Decoder::MARKER_FF;
+            }
+            break;
+        }
+        case Decoder::SEGMENT:
+            d.segment[d.segmentLength - d.remaining] = b;
+            if (--d.remaining == 0 && !header(d)) d.state = Decoder::FAILED;
+            break;
+        case Decoder::SKIP_SCAN:
+            // Entropy data of a scan that is not decoded; ends at the next marker
+            // that is neither a stuffed 0xFF nor a restart marker
+            if (d.pendingFF) {
+                d.pendingFF = false;
+                if (b == 0xFF) d.pendingFF = true;
+                else if (b != 0x00 && (b < 0xD0 || b > 0xD7)) marker(d, b);
+            } else if (b == 0xFF) {
+                d.pendingFF = true;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void MFPJpegThumbnail::marker(Decoder& d, uint8_t code) {
+    d.marker = code;
+    if (code == 0xD9) d.state = Decoder::FAILED;  // EOI before the luma scan was decoded
+    else if (isStandalone(code)) d.state = Decoder::MARKER_FF;
+    else d.state = Decoder::LENGTH_HIGH;
+}
+
+bool MFPJpegThumbnail::header(Decoder& d) {
+    d.state = Decoder::MARKER_FF;
+    switch (d.marker) {
+    case 0xC4:
+        return huffman(d);
+    case 0xDB:
+        return quantization(d);
+    case 0xDD:
+        if (d.segmentLength < 2) return false;
+        d.restartInterval = (d.segment[0] << 8) | d.segment[1];
+        return true;
+    case 0xDA:
+        return scanHeader(d);
+    default:
+        return frame(d);
+    }
+}
+
+bool MFPJpegThumbnail::quantization(Decoder& d) {
+    size_t i = 0;
+    while (i < d.segmentLength) {
+        uint8_t precision = d.segment[i] >> 4;
+        uint8_t id = d.segment[i] & 15;
+        size_t size = precision ? 129 : 65;
+        if (id > 3 || i + size > d.segmentLength) return false;
+        // Only the DC entry matters; it comes first in zigzag order
+        d.quant[id] = precision ? (d.segment[i + 1] << 8) | d.segment[i + 2] : d.segment[i + 1];
+        d.quantDefined[id] = true;
+        i += size;
+    }
+    return true;
+}
+
+bool MFPJpegThumbnail::huffman(Decoder& d) {
+    size_t i = 0;
+    while (i < d.segmentLength) {
+        uint8_t tableClass = d.segment[i] >> 4;
+        uint8_t id = d.segment[i] & 15;
+        if (tableClass > 1 || id > 1 || i + 17 > d.segmentLength) return false;
+        const uint8_t* counts = d.segment + i + 1;
+        size_t total = 0;
+        for (int len = 0; len < 16; len++) total += counts[len];
+        if (total > 256 || i + 17 + total > d.segmentLength) return false;
+
+        Decoder::Huffman& h = d.tables[tableClass * 2 + id];
+        h.defined = false;
+        memset(h.look, 0, sizeof(h.look));
+        memcpy(h.values, d.segment + i + 17, total);
+        // Canonical codes (JPEG Annex C): consecutive within a length, shifted left for the next
+        int32_t code = 0;
+        size_t k = 0;
+        for (int len = 1; len <= 16; len++) {
+            h.valOffset[len] = (int32_t)k - code;
+            for (int n = 0; n < counts[len - 1]; n++, k++, code++) {
+                // More codes than the length allows: the table would overrun look[]
+                if (code >= (1 << len)) return false;
+                if (len <= 8) {
+                    int shift = 8 - len;
+                    for (int fill = 0; fill < (1 << shift); fill++) h.look[(code << shift) | fill] = (len << 8) | h.values[k];
+                }
+            }
+            h.maxCode[len] = counts[len - 1] ? code - 1 : -1;
+            code <<= 1;
+        }
+        h.defined = true;
+        i += 17 + total;
+    }
+    return true;
+}
+
+bool MFPJpegThumbnail::frame(Decoder& d) {
+    const uint8_t* s = d.segment;
+    if (d.haveFrame || d.segmentLength < 6 || s[0] != 8) return false;  // one 8-bit frame
+    d.progressive = d.marker == 0xC2;
+    d.height = (s[1] << 8) | s[2];
+    d.width = (s[3] << 8) | s[4];
+    d.componentCount = s[5];
+    if (d.width == 0 || d.height == 0 || d.componentCount == 0 || d.componentCount > 4) return false;
+    if (d.segmentLength < 6 + 3 * d.componentCount) return false;
+    d.hMax = 1;
+    d.vMax = 1;
+    for (int c = 0; c < d.componentCount; c++) {
+        Decoder::Component& comp = d.components[c];
+        comp.id = s[6 + c * 3];
+        comp.h = s[7 + c * 3] >> 4;
+        comp.v = s[7 + c * 3] & 15;
+        comp.quant = s[8 + c * 3];
+        if (comp.h < 1 || comp.h > 4 || comp.v < 1 || comp.v > 4 || comp.quant > 3) return false;
+        if (comp.h > d.hMax) d.hMax = comp.h;
+        if (comp.v > d.vMax) d.vMax = comp.v;
+    }
+    for (int c = 0; c < d.componentCount; c++) {
+        Decoder::Component& comp = d.components[c];
+        comp.blocksW = ((d.width * comp.h + d.hMax - 1) / d.hMax + 7) / 8;
+        comp.blocksH = ((d.height * comp.v + d.vMax - 1) / d.vMax + 7) / 8;
+    }
+    d.haveFrame = true;
+
+    // The first component is luma; its blocks are averaged f x f until the thumbnail fits
+    uint32_t bw = d.components[0].blocksW;
+    uint32_t bh = d.components[0].blocksH;
+    uint32_t f = 1;
+    while ((bw + f - 1) / f > maxWidth || (bh + f - 1) / f > maxHeight) f++;
+    if (f > 255) return false;
+    factor = f;
+    thumbWidth = (bw + f - 1) / f;
+    thumbHeight = (bh + f - 1) / f;
+    size_t size = (size_t)thumbWidth * thumbHeight;
+    if (size > thumbCapacity) {
+        free(thumb);
+        thumb = (uint8_t*)malloc(size);
+        thumbCapacity = thumb ? size : 0;
+    }
+    d.sums = (uint32_t*)calloc(sumRows * thumbWidth, sizeof(uint32_t));
+    if (!thumb || !d.sums) {
+        Serial.println("Not enough memory for the thumbnail");
+        return false;
+    }
+    return true;
+}
+
+bool MFPJpegThumbnail::scanHeader(Decoder& d) {
+    const uint8_t* s = d.segment;
+    if (!d.haveFrame || d.segmentLength < 1) return false;
+    uint8_t count = s[0];
+    if (count < 1 || count > 4 || d.segmentLength < 4 + 2 * count) return false;
+    d.ss = s[1 + 2 * count];
+    d.se = s[2 + 2 * count];
+    uint8_t ah = s[3 + 2 * count] >> 4;
+    d.al = s[3 + 2 * count] & 15;
+
+    bool luma = false;
+    d.mcuBlockCount = 0;
+    for (int n = 0; n < count; n++) {
+        int c = 0;
+        while (c < d.componentCount && d.components[c].id != s[1 + 2 * n]) c++;
+        if (c == d.componentCount) return false;
+        Decoder::Component& comp = d.components[c];
+        comp.dcTable = s[2 + 2 * n] >> 4;
+        comp.acTable = s[2 + 2 * n] & 15;
+        comp.pred = 0;
+        if (c == 0) luma = true;
+        int blocks = count == 1 ? 1 : comp.h * comp.v;
+        if (d.mcuBlockCount + blocks > 10) return false;
+        for (int b = 0; b < blocks; b++) {
+            d.mcuComponent[d.mcuBlockCount] = c;
+            d.mcuSub[d.mcuBlockCount] = b;
+            d.mcuBlockCount++;
+        }
+    }
+
+    // Baseline: the scan holding luma. Progressive: its first DC scan; the
+    // AC and refinement scans that follow are never needed.
+    bool wanted = luma && (d.progressive ? d.ss == 0 && d.se == 0 && ah == 0 : d.ss == 0 && d.se == 63);
+    if (!wanted) {
+        d.pendingFF = false;
+        d.state = Decoder::SKIP_SCAN;
+        return true;
+    }
+    for (int b = 0; b < d.mcuBlockCount; b++) {
+        const Decoder::Component& comp = d.components[d.mcuComponent[b]];
+        if (comp.dcTable > 1 || !d.tables[comp.dcTable].defined) return false;
+        if (d.se > 0 && (comp.acTable > 1 || !d.tables[2 + comp.acTable].defined)) return false;
+        if (!d.quantDefined[comp.quant]) return false;
+    }
+
+    d.interleaved = count > 1;
+    if (d.interleaved) {
+        d.mcusX = (d.width + 8 * d.hMax - 1) / (8 * d.hMax);
+        d.mcuTotal = d.mcusX * ((d.height + 8 * d.vMax - 1) / (8 * d.vMax));
+    } else {
+        // One component alone is coded block by block, without MCU padding
+        d.mcusX = d.components[d.mcuComponent[0]].blocksW;
+        d.mcuTotal = d.mcusX * d.components[d.mcuComponent[0]].blocksH;
+    }
+    d.mcu = 0;
+    d.blockIndex = 0;
+    d.k = 0;
+    d.symbol = -1;
+    d.restartLeft = d.restartInterval;
+    d.syncing = false;
+    d.acc = 0;
+    d.bits = 0;
+    d.overrun = 0;
+    d.markerHit = false;
+    d.pendingFF = false;
+    d.flushedRows = 0;
+    d.state = Decoder::ENTROPY;
+    return true;
+}
+
+// Moves bytes into the bit reader until it holds more than 24 bits, unstuffing
+// 0xFF 0x00. Stops at a marker, which ends the data of the restart interval.
+// Returns false if the block ran out first.
+bool MFPJpegThumbnail::fill(Decoder& d, const uint8_t*& data, const uint8_t* end) {
+    while (d.bits <= 24 && !d.markerHit) {
+        if (data == end) return false;
+        uint8_t b = *data++;
+        if (d.pendingFF) {
+            d.pendingFF = false;
+            if (b == 0xFF) {
+                d.pendingFF = true;  // fill bytes before a marker
+                continue;
+            }
+            if (b != 0x00) {
+                d.markerHit = true;
+                d.markerCode = b;
+                break;
+            }
+            b = 0xFF;
+        } else if (b == 0xFF) {
+            d.pendingFF = true;
+            continue;
+        }
+        d.acc |= (uint32_t)b << (24 - d.bits);
+        d.bits += 8;
+    }
+    return true;
+}
+
+size_t MFPJpegThumbnail::entropy(Decoder& d, const uint8_t* data, size_t len) {
+    const uint8_t* p = data;
+    const uint8_t* end = data + len;
+
+    auto take = [&d](uint8_t n) -> uint32_t {
+        uint32_t v = n ? d.acc >> (32 - n) : 0;
+        if (n > d.bits) {
+            // Past the marker the data is padded with zeros; a few bits is normal, more is corrupt
+            d.overrun += n - d.bits;
+            d.bits = 0;
+        } else {
+            d.bits -= n;
+        }
+        d.acc = n < 32 ? d.acc << n : 0;
+        return v;
+    };
+
+    while (d.state == Decoder::ENTROPY) {
+        if (d.syncing) {
+            // The interval is over but its RST marker has not been read yet
+            while (p < end && d.syncing) {
+                uint8_t b = *p++;
+                if (d.pendingFF) {
+                    d.pendingFF = false;
+                    if (b >= 0xD0 && b <= 0xD7) d.syncing = false;
+                    else if (b == 0xFF) d.pendingFF = true;
+                    else if (b != 0x00) {
+                        d.state = Decoder::FAILED;
+                        break;
+                    }
+                } else if (b == 0xFF) {
+                    d.pendingFF = true;
+                }
+            }
+            if (d.syncing) break;
+            continue;
+        }
+
+        if (d.symbol < 0) {
+            if (!fill(d, p, end) && d.bits < 16) break;  // wait for the next block
+            int component = d.mcuComponent[d.blockIndex];
+            const Decoder::Huffman& h = d.tables[d.k == 0 ? d.components[component].dcTable : 2 + d.components[component].acTable];
+            uint16_t look = h.look[d.acc >> 24];
+            if (look) {
+                take(look >> 8);
+                d.symbol = look & 0xFF;
+            } else {
+                int len = 9;
+                while (len <= 16 && (int32_t)(d.acc >> (32 - len)) > h.maxCode[len]) len++;
+                if (len > 16) {
+                    d.state = Decoder::FAILED;
+                    break;
+                }
+                int32_t code = d.acc >> (32 - len);
+                take(len);
+                d.symbol = h.values[code + h.valOffset[len]];
+            }
+        }
+
+        // Extra bits of the symbol: the DC difference, or the AC value that is skipped
+        uint8_t size = d.symbol & 15;
+        if (d.k == 0) size = d.symbol;
+        if (size > 16) {
+            d.state = Decoder::FAILED;
+            break;
+        }
+        if (d.bits < size && !d.markerHit) {
+            if (!fill(d, p, end) && d.bits < size) break;
+        }
+        uint32_t extra = take(size);
+        if (d.overrun > 16) {
+            d.state = Decoder::FAILED;
+            break;
+        }
+
+        int component = d.mcuComponent[d.blockIndex];
+        bool blockDone;
+        if (d.k == 0) {
+            int32_t diff = extra;
+            if (size && diff < (1 << (size - 1))) diff -= (1 << size) - 1;
+            d.components[component].pred += diff;
+            block(d, component, d.components[component].pred * (1 << d.al));
+            blockDone = d.se == 0;
+            d.k = 1;
+        } else {
+            uint8_t run = d.symbol >> 4;
+            if ((d.symbol & 15) == 0) d.k = run == 15 ? d.k + 16 : 64;  // ZRL or end of block
+            else d.k += run + 1;
+            blockDone = d.k >= 64;
+        }
+        d.symbol = -1;
+        if (!blockDone) continue;
+
+        d.k = 0;
+        if (++d.blockIndex < d.mcuBlockCount) continue;
+        d.blockIndex = 0;
+        d.mcu++;
+        if (d.mcu % d.mcusX == 0 || d.mcu == d.mcuTotal) {
+            const Decoder::Component& luma = d.components[0];
+            rowsDone(d, d.interleaved ? (d.mcu + d.mcusX - 1) / d.mcusX * luma.v : (d.mcu + d.mcusX - 1) / d.mcusX);
+        }
+        if (d.mcu == d.mcuTotal) {
+            d.state = Decoder::DONE;
+            break;
+        }
+        if (d.restartInterval && --d.restartLeft == 0) {
+            // Each interval starts on a byte boundary with the DC predictions reset
+            d.restartLeft = d.restartInterval;
+            for (int c = 0; c < d.componentCount; c++) d.components[c].pred = 0;
+            d.acc = 0;
+            d.bits = 0;
+            d.overrun = 0;
+            if (d.markerHit) {
+                if (d.markerCode < 0xD0 || d.markerCode > 0xD7) {
+                    d.state = Decoder::FAILED;
+                    break;
+                }
+                d.markerHit = false;
+            } else {
+                d.syncing = true;
+            }
+        }
+    }
+    return p - data;
+}
+
+void MFPJpegThumbnail::block(Decoder& d, int component, int dc) {
+    if (component != 0) return;
+    const Decoder::Component& luma = d.components[0];
+    uint8_t sub = d.mcuSub[d.blockIndex];
+    uint32_t col, row;
+    if (d.interleaved) {
+        col = (d.mcu % d.mcusX) * luma.h + sub % luma.h;
+        row = (d.mcu / d.mcusX) * luma.v + sub / luma.h;
+    } else {
+        col = d.mcu % d.mcusX;
+        row = d.mcu / d.mcusX;
+    }
+    if (col >= luma.blocksW || row >= luma.blocksH) return;  // MCU padding
+    // A block's mean is DC * q / 8 around 128, rounded as a 1x1 IDCT does
+    int value = ((dc * d.quant[luma.quant] + 4) >> 3) + 128;
+    if (value < 0) value = 0;
+    if (value > 255) value = 255;
+    d.sums[(row / factor % sumRows) * thumbWidth + col / factor] += value;
+}
+
+void MFPJpegThumbnail::rowsDone(Decoder& d, uint32_t blockRows) {
+    const Decoder::Component& luma = d.components[0];
+    if (blockRows > luma.blocksH) blockRows = luma.blocksH;
+    while (d.flushedRows < thumbHeight && ((d.flushedRows + 1) * factor <= blockRows || blockRows == luma.blocksH)) {
+        uint32_t r = d.flushedRows;
+        uint32_t rows = luma.blocksH - r * factor < factor ? luma.blocksH - r * factor : factor;
+        uint32_t* sum = d.sums + (r % sumRows) * thumbWidth;
+        for (uint32_t x = 0; x < thumbWidth; x++) {
+            uint32_t cols = luma.blocksW - x * factor < factor ? luma.blocksW - x * factor : factor;
+            uint32_t n = rows * cols;
+            thumb[r * thumbWidth + x] = (sum[x] + n / 2) / n;
+            sum[x] = 0;
+        }
+        d.flushedRows++;
+    }
+}
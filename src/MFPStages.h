@@ -0,0 +1,127 @@
+#ifndef MFPStages_h
+#define MFPStages_h
+
+#include <Arduino.h>
+#include <mbedtls/sha256.h>
+
+// Processing stage on the scan pipeline: sees the image block by block as it
+// arrives, so its result is ready when the transfer ends, without a second pass.
+// Stages only observe; a stage that cannot handle an image never fails the scan.
+class MFPStage {
+public:
+    virtual ~MFPStage() {}
+    virtual void begin() = 0;                                // a new image (or page) starts
+    virtual void feed(const uint8_t* data, size_t len) = 0;
+    virtual void end() = 0;                                  // the image is complete
+};
+
+// CRC-32 (IEEE, as zlib and PNG) in ROM code
+class MFPCrc32 : public MFPStage {
+public:
+    MFPCrc32();
+    void begin() override;
+    void feed(const uint8_t* data, size_t len) override;
+    void end() override;
+
+    bool ready() const;
+    uint32_t value() const;
+
+private:
+    uint32_t crc;
+    bool complete;
+};
+
+// SHA-256 through mbedTLS, which uses the hardware accelerator where the chip has one
+class MFPSha256 : public MFPStage {
+public:
+    MFPSha256();
+    ~MFPSha256();
+    void begin() override;
+    void feed(const uint8_t* data, size_t len) override;
+    void end() override;
+
+    bool ready() const;
+    const uint8_t* digest() const;  // 32 bytes
+    void hex(char* out) const;      // out must hold 65 chars
+
+private:
+    mbedtls_sha256_context context;
+    uint8_t hash[32];
+    bool complete;
+};
+
+// Reads width, height and component count from the JPEG frame header (SOFn).
+// Stops looking once the frame header is parsed; the rest is only counted.
+class MFPJpegProbe : public MFPStage {
+public:
+    MFPJpegProbe();
+    void begin() override;
+    void feed(const uint8_t* data, size_t len) override;
+    void end() override;
+
+    bool ready() const;        // frame header found
+    uint16_t width() const;
+    uint16_t height() const;
+    uint8_t components() const;
+    bool progressive() const;
+    size_t bytes() const;      // image bytes seen
+
+private:
+    enum State { SOI_FF, SOI_D8, MARKER_FF, MARKER, LENGTH_HIGH, LENGTH_LOW, SEGMENT, DONE, INVALID };
+
+    State state;
+    uint8_t marker;
+    uint16_t remaining;    // segment bytes left to read
+    uint16_t offset;       // position inside a SOF segment
+    uint8_t frame[6];      // precision, height, width, components
+    size_t total;
+    bool found;
+    bool isProgressive;
+};
+
+// Thumbnail decoded from the DC coefficients of a baseline or progressive JPEG:
+// each 8x8 luma block becomes one pixel, and blocks are averaged further until
+// the thumbnail fits maxWidth x maxHeight. Only the Huffman tables and a few
+// block rows of sums are held while decoding; the grayscale thumbnail is ready
+// when the image ends. Arithmetic-coded and 12-bit JPEGs are not supported.
+class MFPJpegThumbnail : public MFPStage {
+public:
+    MFPJpegThumbnail(uint16_t maxWidth = 160, uint16_t maxHeight = 120);
+    ~MFPJpegThumbnail();
+    void begin() override;
+    void feed(const uint8_t* data, size_t len) override;
+    void end() override;
+
+    bool ready() const;
+    uint16_t width() const;
+    uint16_t height() const;
+    const uint8_t* pixels() const;  // 8-bit gray, width() * height(), row by row
+    uint8_t scale() const;          // blocks per thumbnail pixel in each direction
+
+private:
+    struct Decoder;
+
+    uint16_t maxWidth;
+    uint16_t maxHeight;
+    uint16_t thumbWidth;
+    uint16_t thumbHeight;
+    uint8_t factor;
+    uint8_t* thumb;
+    size_t thumbCapacity;
+    bool complete;
+    Decoder* decoder;  // only while an image is being decoded
+
+    void release();
+    void marker(Decoder& d, uint8_t code);
+    bool header(Decoder& d);
+    bool frame(Decoder& d);
+    bool huffman(Decoder& d);
+    bool quantization(Decoder& d);
+    bool scanHeader(Decoder& d);
+    size_t entropy(Decoder& d, const uint8_t* data, size_t len);
+    bool fill(Decoder& d, const uint8_t*& data, const uint8_t* end);
+    void block(Decoder& d, int component, int dc);
+    void rowsDone(Decoder& d, uint32_t blockRows);
+};
+
+#endif
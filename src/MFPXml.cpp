@@ -0,0 +1,304 @@
+#include "MFPXml.h"
+
+MFPXmlParser::MFPXmlParser() : watchCount(0) {
+    begin();
+}
+
+// FNV-1a over the local name; a ':' drops the namespace prefix read so far
+uint32_t MFPXmlParser::hashStart() {
+    return 2166136261u;
+}
+
+uint32_t MFPXmlParser::hashAdd(uint32_t hash, char c) {
+    if (c == ':') return hashStart();
+    return (hash ^ (uint8_t)c) * 16777619u;
+}
+
+uint32_t MFPXmlParser::hashName(const char* name, size_t len) {
+    uint32_t hash = hashStart();
+    for (size_t i = 0; i < len; i++) hash = hashAdd(hash, name[i]);
+    return hash;
+}
+
+bool MFPXmlParser::isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+int MFPXmlParser::watch(const char* path) {
+    if (watchCount >= maxWatches || !path) return -1;
+    Watch& w = watches[watchCount];
+    w.count = 0;
+    w.attribute = 0;
+
+    const char* start = path;
+    for (const char* p = path;; p++) {
+        if (*p == '/' || *p == '@' || *p == 0) {
+            if (p > start) {
+                if (w.count >= maxSegments) return -1;
+                w.segments[w.count++] = hashName(start, p - start);
+            }
+            if (*p == '@') {
+                w.attribute = hashName(p + 1, strlen(p + 1));
+                break;
+            }
+            if (*p == 0) break;
+            start = p + 1;
+        }
+    }
+    if (w.count == 0) return -1;
+    return watchCount++;
+}
+
+void MFPXmlParser::onValue(XmlValueHandler valueHandler) {
+    handler = valueHandler;
+}
+
+void MFPXmlParser::begin() {
+    state = TEXT;
+    depth = 0;
+    nameHash = hashStart();
+    attrHash = 0;
+    quote = 0;
+    matchCount = 0;
+    bangCdata = false;
+    textLen = 0;
+    entityLen = 0;
+    entityReturn = TEXT;
+}
+
+bool MFPXmlParser::matches(const Watch& w, int level) const {
+    if (level == 0 || level > maxDepth) return false;
+    if (stack[level - 1] != w.segments[w.count - 1]) return false;
+    // Earlier segments must appear as ancestors, in order
+    int j = w.count - 2;
+    for (int i = level - 2; i >= 0 && j >= 0; i--) {
+        if (stack[i] == w.segments[j]) j--;
+    }
+    return j < 0;
+}
+
+void MFPXmlParser::emit(int id, const char* value, size_t len) {
+    while (len > 0 && isSpace(*value)) {
+        value++;
+        len--;
+    }
+    while (len > 0 && isSpace(value[len - 1])) len--;
+    // value points into text, which always has room for the terminator
+    char saved = value[len];
+    ((char*)value)[len] = 0;
+    if (handler) handler(id, value, len);
+    ((char*)value)[len] = saved;
+}
+
+void MFPXmlParser::openElement() {
+    if (depth < maxDepth) stack[depth] = nameHash;
+    depth++;
+    textLen = 0;
+}
+
+void MFPXmlParser::closeElement() {
+    if (depth == 0) return;
+    text[textLen] = 0;
+    for (int i = 0; i < watchCount; i++) {
+        if (watches[i].attribute == 0 && matches(watches[i], depth)) emit(i, text, textLen);
+    }
+    depth--;
+    textLen = 0;
+}
+
+void MFPXmlParser::appendText(char c) {
+    if (textLen < maxText - 1) text[textLen++] = c;
+}
+
+void MFPXmlParser::finishEntity() {
+    entity[entityLen] = 0;
+    char c = 0;
+    if (strcmp(entity, "amp") == 0) c = '&';
+    else if (strcmp(entity, "lt") == 0) c = '<';
+    else if (strcmp(entity, "gt") == 0) c = '>';
+    else if (strcmp(entity, "quot") == 0) c = '"';
+    else if (strcmp(entity, "apos") == 0) c = '\'';
+    else if (entity[0] == '#') {
+        long code = entity[1] == 'x' ? strtol(entity + 2, nullptr, 16) : atol(entity + 1);
+        if (code > 0 && code < 128) c = (char)code;
+    }
+    if (c) {
+        appendText(c);
+    } else {
+        // Unknown entity: keep it as written
+        appendText('&');
+        for (size_t i = 0; i < entityLen; i++) appendText(entity[i]);
+        appendText(';');
+    }
+    entityLen = 0;
+    state = entityReturn;
+}
+
+bool MFPXmlParser::feed(const uint8_t* data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        char c = (char)data[i];
+        switch (state) {
+        case TEXT:
+            if (c == '<') state = TAG_START;
+            else if (c == '&') {
+                entityReturn = TEXT;
+                state = ENTITY;
+            } else appendText(c);
+            break;
+
+        case ENTITY:
+            if (c == ';') {
+                finishEntity();
+            } else if (entityLen < maxEntity - 1 && !isSpace(c) && c != '<' && c != '&') {
+                entity[entityLen++] = c;
+            } else {
+                // Stray '&': keep it as text and look at c again
+                appendText('&');
+                for (size_t k = 0; k < entityLen; k++) appendText(entity[k]);
+                entityLen = 0;
+                state = entityReturn;
+                i--;
+            }
+            break;
+
+        case TAG_START:
+            if (c == '/') {
+                state = END_TAG;
+            } else if (c == '?') {
+                state = SKIP_DECL;
+            } else if (c == '!') {
+                state = BANG;
+                matchCount = 0;
+            } else if (isSpace(c) || c == '>') {
+                return false;
+            } else {
+                nameHash = hashAdd(hashStart(), c);
+                state = TAG_NAME;
+            }
+            break;
+
+        case TAG_NAME:
+            if (isSpace(c)) {
+                openElement();
+                state = ATTR_SPACE;
+            } else if (c == '/') {
+                openElement();
+                state = EMPTY_TAG;
+            } else if (c == '>') {
+                openElement();
+                state = TEXT;
+            } else {
+                nameHash = hashAdd(nameHash, c);
+            }
+            break;
+
+        case ATTR_SPACE:
+            if (c == '/') state = EMPTY_TAG;
+            else if (c == '>') {
+                textLen = 0;
+                state = TEXT;
+            } else if (!isSpace(c)) {
+                nameHash = hashAdd(hashStart(), c);
+                state = ATTR_NAME;
+            }
+            break;
+
+        case ATTR_NAME:
+            if (c == '=' || isSpace(c)) {
+                attrHash = nameHash;
+                state = ATTR_EQ;
+            } else {
+                nameHash = hashAdd(nameHash, c);
+            }
+            break;
+
+        case ATTR_EQ:
+            if (c == '"' || c == '\'') {
+                quote = c;
+                textLen = 0;
+                state = ATTR_VALUE;
+            } else if (!isSpace(c) && c != '=') {
+                return false;
+            }
+            break;
+
+        case ATTR_VALUE:
+            if (c == quote) {
+                text[textLen] = 0;
+                for (int w = 0; w < watchCount; w++) {
+                    if (watches[w].attribute == attrHash && matches(watches[w], depth)) emit(w, text, textLen);
+                }
+                textLen = 0;
+                state = ATTR_SPACE;
+            } else if (c == '&') {
+                entityReturn = ATTR_VALUE;
+                state = ENTITY;
+            } else {
+                appendText(c);
+            }
+            break;
+
+        case EMPTY_TAG:
+            if (c != '>') return false;
+            textLen = 0;
+            closeElement();
+            state = TEXT;
+            break;
+
+        case END_TAG:
+            // Documents are assumed well formed; the name is not checked
+            if (c == '>') {
+                closeElement();
+                state = TEXT;
+            }
+            break;
+
+        case BANG: {
+            // "<!--" comment, "<![CDATA[" section, or a declaration to skip
+            static const char cdata[] = "[CDATA[";
+            if (matchCount == 0) bangCdata = c == '[';
+            const char* expect = bangCdata ? cdata : "--";
+            size_t expectLen = bangCdata ? 7 : 2;
+            if (c != expect[matchCount]) {
+                state = c == '>' ? TEXT : SKIP_DECL;
+                break;
+            }
+            if (++matchCount == expectLen) {
+                state = bangCdata ? CDATA : COMMENT;
+                matchCount = 0;
+            }
+            break;
+        }
+
+        case SKIP_DECL:
+            if (c == '>') state = TEXT;
+            break;
+
+        case COMMENT:
+            if (c == '-') {
+                matchCount++;
+            } else if (c == '>' && matchCount >= 2) {
+                state = TEXT;
+                matchCount = 0;
+            } else {
+                matchCount = 0;
+            }
+            break;
+
+        case CDATA:
+            if (c == ']') {
+                matchCount++;
+            } else if (c == '>' && matchCount >= 2) {
+                for (int k = 2; k < matchCount; k++) appendText(']');
+                state = TEXT;
+                matchCount = 0;
+            } else {
+                for (int k = 0; k < matchCount; k++) appendText(']');
+                appendText(c);
+                matchCount = 0;
+            }
+            break;
+        }
+    }
+    return true;
+}
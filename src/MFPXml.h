@@ -0,0 +1,82 @@
+#ifndef MFPXml_h
+#define MFPXml_h
+
+#include <Arduino.h>
+#include <functional>
+
+// Called when a watched element (or attribute) is complete. text is the
+// element's direct character data, entity-decoded and trimmed.
+typedef std::function<void(int id, const char* text, size_t len)> XmlValueHandler;
+
+// Streaming XML parser for SOAP responses. Callers register the element
+// paths they need and get every value in one pass over the socket bytes;
+// the document itself is never held in memory.
+//
+// Paths are local names separated by '/', matched against the end of the
+// current element path, so namespace prefixes do not matter:
+//   "JobId"            any JobId element
+//   "Hosted/Address"   an Address element below a Hosted element
+//   "ModelName@lang"   the lang attribute (xml:lang) of ModelName
+// A watched container element (e.g. "Hosted") reports an empty value when it
+// closes, which marks the end of a repeated block.
+class MFPXmlParser {
+public:
+    MFPXmlParser();
+
+    // Returns the watch id, or -1 if the path is too long or too many are registered
+    int watch(const char* path);
+    void onValue(XmlValueHandler handler);
+
+    // Resets the document state; watches and handler are kept
+    void begin();
+    bool feed(const uint8_t* data, size_t len);
+
+private:
+    enum State { TEXT, ENTITY, TAG_START, TAG_NAME, END_TAG, ATTR_SPACE, ATTR_NAME, ATTR_EQ, ATTR_VALUE, EMPTY_TAG, BANG, SKIP_DECL, COMMENT, CDATA };
+
+    static const int maxDepth = 16;
+    static const int maxWatches = 16;
+    static const int maxSegments = 4;
+    static const size_t maxText = 160;
+    static const size_t maxEntity = 8;  // element and attribute names are only kept as hashes
+
+    struct Watch {
+        uint32_t segments[maxSegments];
+        uint8_t count;
+        uint32_t attribute;  // 0 = element text
+    };
+
+    Watch watches[maxWatches];
+    int watchCount;
+    XmlValueHandler handler;
+
+    State state;
+    uint32_t stack[maxDepth];
+    int depth;
+
+    uint32_t nameHash;      // local name being read (tag or attribute)
+    uint32_t attrHash;
+    char quote;
+    uint8_t matchCount;     // chars matched while looking for "--", "[CDATA[", "-->" or "]]>"
+    bool bangCdata;
+
+    char text[maxText];
+    size_t textLen;
+    char entity[maxEntity];
+    size_t entityLen;
+    State entityReturn;
+
+    static uint32_t hashStart();
+    static uint32_t hashAdd(uint32_t hash, char c);
+    static uint32_t hashName(const char* name, size_t len);
+    static bool isSpace(char c);
+
+    void openElement();
+    void closeElement();
+    bool matches(const Watch& w, int level) const;
+    void appendText(char c);
+    void finishEntity();
+    void emit(int id, const char* value, size_t len);
+};
+
+#endif